@@ -0,0 +1,154 @@
+/* Compares jsmn_parse with and without JSMN_FAST_SCAN: both must produce the
+ * same tokens, then each payload is parsed in a loop to measure throughput.
+ * Whitespace is also stripped from every payload, as json_parser's streams
+ * do, since that's what the device actually tokenizes. */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#define JSMN_HEADER
+#include "jsmn.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define MAX_TOKENS 4096
+#define MIN_BYTES (64 * 1024 * 1024)
+
+int parse_scalar(const char *js, size_t len, jsmntok_t *tokens, unsigned int num_tokens);
+int parse_fast(const char *js, size_t len, jsmntok_t *tokens, unsigned int num_tokens);
+
+typedef int (*parse_fn_t)(const char *, size_t, jsmntok_t *, unsigned int);
+
+static jsmntok_t tokens_a[MAX_TOKENS];
+static jsmntok_t tokens_b[MAX_TOKENS];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int same_tokens(const char *js, size_t len)
+{
+    memset(tokens_a, 0, sizeof(tokens_a));
+    memset(tokens_b, 0, sizeof(tokens_b));
+    int a = parse_scalar(js, len, tokens_a, MAX_TOKENS);
+    int b = parse_fast(js, len, tokens_b, MAX_TOKENS);
+    return a == b && (a <= 0 || memcmp(tokens_a, tokens_b, a * sizeof(jsmntok_t)) == 0);
+}
+
+/* Strings with escapes, control chars and quotes at every alignment */
+static int check_random(void)
+{
+    static const char alphabet[] = "ab\\\"\x01 \xc3\xa9/u0";
+    char js[96];
+    srand(1);
+    for (int i = 0; i < 200000; i++) {
+        int n = 2 + rand() % 60;
+        int off = rand() % 16;
+        memset(js, ' ', sizeof(js));
+        js[off] = '[';
+        js[off + 1] = '"';
+        for (int j = 0; j < n; j++) {
+            js[off + 2 + j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+        js[off + 2 + n] = '"';
+        js[off + 3 + n] = ']';
+        if (!same_tokens(js, off + 4 + n) || !same_tokens(js, off + 2 + rand() % (n + 2))) {
+            fprintf(stderr, "mismatch on: %.*s\n", off + 4 + n, js);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void bench(const char *name, parse_fn_t parse, const char *js, size_t len)
+{
+    int iterations = MIN_BYTES / len + 1;
+    uint64_t t0 = now_ns(), c0 = cycles();
+    for (int i = 0; i < iterations; i++) {
+        if (parse(js, len, tokens_a, MAX_TOKENS) <= 0) {
+            fprintf(stderr, "parse error\n");
+            exit(1);
+        }
+    }
+    uint64_t c = cycles() - c0, t = now_ns() - t0;
+    double bytes = (double) len * iterations;
+    printf("  %-7s %8.1f MB/s", name, bytes / t * 1000);
+    if (c) {
+        printf("  %5.2f bytes/cycle", bytes / c);
+    }
+    printf("\n");
+}
+
+static size_t strip_whitespace(char *js, size_t len)
+{
+    size_t out = 0;
+    int in_string = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = js[i];
+        if (in_string) {
+            if (c == '\\' && i + 1 < len) {
+                js[out++] = c;
+                c = js[++i];
+            } else if (c == '"') {
+                in_string = 0;
+            }
+        } else if (c == '"') {
+            in_string = 1;
+        } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            continue;
+        }
+        js[out++] = c;
+    }
+    js[out] = 0;
+    return out;
+}
+
+int main(int argc, char **argv)
+{
+    if (check_random() != 0) {
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (!f) {
+            perror(argv[i]);
+            return 1;
+        }
+        fseek(f, 0, SEEK_END);
+        size_t len = ftell(f);
+        rewind(f);
+        char *js = malloc(len + 1);
+        if (!js || fread(js, 1, len, f) != len) {
+            return 1;
+        }
+        fclose(f);
+        js[len] = 0;
+
+        for (int pass = 0; pass < 2; pass++) {
+            if (!same_tokens(js, len)) {
+                fprintf(stderr, "%s: tokens differ\n", argv[i]);
+                return 1;
+            }
+            printf("%s (%s, %zu bytes)\n", argv[i], pass ? "stripped" : "as captured", len);
+            bench("scalar", parse_scalar, js, len);
+            bench("fast", parse_fast, js, len);
+            len = strip_whitespace(js, len);
+        }
+        free(js);
+    }
+    return 0;
+}
@@ -0,0 +1,10 @@
+/* Built once per scanner, see the Makefile */
+#define JSMN_STATIC
+#include "jsmn.h"
+
+int PARSE(const char *js, size_t len, jsmntok_t *tokens, unsigned int num_tokens)
+{
+    jsmn_parser parser;
+    jsmn_init(&parser);
+    return jsmn_parse(&parser, js, len, tokens, num_tokens);
+}
@@ -25,6 +25,9 @@
 #define JSMN_H
 
 #include <stddef.h>
+#ifdef JSMN_COMPACT_TOKENS
+#include <stdint.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,6 +39,10 @@ extern "C" {
 #define JSMN_API extern
 #endif
 
+#if defined(JSMN_SIBLING_LINKS) && !defined(JSMN_PARENT_LINKS)
+#error "JSMN_SIBLING_LINKS requires JSMN_PARENT_LINKS"
+#endif
+
 /**
  * JSON type identifier. Basic types are:
  *  o Object
@@ -65,7 +72,29 @@ enum jsmnerr {
  * type     type (object, array, string etc.)
  * start    start position in JSON data string
  * end      end position in JSON data string
+ * next     index of the first token after this one's subtree, i.e. its next
+ *          sibling (for a key, the subtree includes its value)
+ *
+ * With JSMN_COMPACT_TOKENS the fields are 16 bits wide: the JSON data must be
+ * shorter than 64 KB and at most JSMN_MAX_TOKENS tokens are used.
  */
+#ifdef JSMN_COMPACT_TOKENS
+typedef struct jsmntok {
+    uint16_t start;
+    uint16_t end;
+    uint16_t size;
+#ifdef JSMN_PARENT_LINKS
+    int16_t parent;
+#endif
+#ifdef JSMN_SIBLING_LINKS
+    uint16_t next;
+#endif
+    uint8_t type; /* jsmntype_t */
+} jsmntok_t;
+
+#define JSMN_POS_UNSET ((uint16_t) -1)
+#define JSMN_MAX_TOKENS INT16_MAX
+#else
 typedef struct jsmntok {
     jsmntype_t type;
     int start;
@@ -74,8 +103,14 @@ typedef struct jsmntok {
 #ifdef JSMN_PARENT_LINKS
     int parent;
 #endif
+#ifdef JSMN_SIBLING_LINKS
+    int next;
+#endif
 } jsmntok_t;
 
+#define JSMN_POS_UNSET (-1)
+#endif
+
 /**
  * JSON parser. Contains an array of token blocks available. Also stores
  * the string being parsed now and current position in that string.
@@ -95,6 +130,10 @@ JSMN_API void jsmn_init(jsmn_parser *parser);
  * Run JSON parser. It parses a JSON data string into and array of tokens, each
  * describing
  * a single JSON object.
+ *
+ * Parsing is resumable: if more bytes are appended to js, calling jsmn_parse
+ * again with the same parser and the new length continues from where the
+ * previous call stopped. JSMN_ERROR_PART is returned until the data is complete.
  */
 JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
                         jsmntok_t *tokens, const unsigned int num_tokens);
@@ -110,15 +149,131 @@ static jsmntok_t *jsmn_alloc_token(jsmn_parser *parser, jsmntok_t *tokens,
     if (parser->toknext >= num_tokens) {
         return NULL;
     }
+#ifdef JSMN_MAX_TOKENS
+    if (parser->toknext >= JSMN_MAX_TOKENS) {
+        return NULL;
+    }
+#endif
     tok = &tokens[parser->toknext++];
-    tok->start = tok->end = -1;
+    tok->start = tok->end = JSMN_POS_UNSET;
     tok->size = 0;
 #ifdef JSMN_PARENT_LINKS
     tok->parent = -1;
+#endif
+#ifdef JSMN_SIBLING_LINKS
+    tok->next = parser->toknext;
 #endif
     return tok;
 }
 
+#ifdef JSMN_SIBLING_LINKS
+/**
+ * A value has been completed. If it belongs to a key, the key's subtree ends
+ * at the same place.
+ */
+static void jsmn_link_sibling(jsmn_parser *parser, jsmntok_t *tokens)
+{
+    if (parser->toksuper != -1 && tokens[parser->toksuper].type == JSMN_STRING) {
+        tokens[parser->toksuper].next = parser->toknext;
+    }
+}
+#endif
+
+#ifdef JSMN_FAST_SCAN
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#else
+#include <stdint.h>
+#include <string.h>
+
+/* Any byte of the word below n (n <= 128), any byte zero */
+#define JSMN_HAS_LESS(x, n) (((x) - 0x01010101u * (n)) & ~(x) & 0x80808080u)
+#define JSMN_HAS_ZERO(x) (((x) - 0x01010101u) & ~(x) & 0x80808080u)
+#endif
+
+/**
+ * Skips the part of a string that needs no attention, i.e. anything but a
+ * quote, a backslash or a control char, several bytes at a time. Returns the
+ * position of the first byte the byte-wise loop has to look at.
+ */
+static unsigned int jsmn_scan_string(const char *js, unsigned int pos,
+                                     const size_t len)
+{
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1F);
+    while (pos + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(js + pos));
+        __m128i special = _mm_or_si128(
+                              _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                              _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+        int mask = _mm_movemask_epi8(special);
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+#else
+    /* Word loads have to be aligned on Xtensa */
+    for (; pos < len && ((uintptr_t)(js + pos) & 3); pos++) {
+        unsigned char c = js[pos];
+        if (c == '\"' || c == '\\' || c < 0x20) {
+            return pos;
+        }
+    }
+    while (pos + 4 <= len) {
+        uint32_t w;
+        memcpy(&w, __builtin_assume_aligned(js + pos, 4), 4);
+        if (JSMN_HAS_LESS(w, 0x20) | JSMN_HAS_ZERO(w ^ 0x22222222u) |
+                JSMN_HAS_ZERO(w ^ 0x5C5C5C5Cu)) {
+            break;
+        }
+        pos += 4;
+    }
+#endif
+    return pos;
+}
+
+/**
+ * Position of the first byte at or after pos that isn't a space, indentation
+ * of pretty printed JSON is skipped in blocks.
+ */
+static unsigned int jsmn_scan_spaces(const char *js, unsigned int pos,
+                                     const size_t len)
+{
+#if defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(' ');
+    while (pos + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(js + pos));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, space)) ^ 0xFFFF;
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+#else
+    for (; pos < len && ((uintptr_t)(js + pos) & 3); pos++) {
+        if (js[pos] != ' ') {
+            return pos;
+        }
+    }
+    while (pos + 4 <= len) {
+        uint32_t w;
+        memcpy(&w, __builtin_assume_aligned(js + pos, 4), 4);
+        if (w != 0x20202020u) {
+            break;
+        }
+        pos += 4;
+    }
+#endif
+    while (pos < len && js[pos] == ' ') {
+        pos++;
+    }
+    return pos;
+}
+#endif
+
 /**
  * Fills token type and boundaries.
  */
@@ -205,7 +360,14 @@ static int jsmn_parse_string(jsmn_parser *parser, const char *js,
     parser->pos++;
 
     for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
-        char c = js[parser->pos];
+        char c;
+#ifdef JSMN_FAST_SCAN
+        parser->pos = jsmn_scan_string(js, parser->pos, len);
+        if (parser->pos >= len || js[parser->pos] == '\0') {
+            break;
+        }
+#endif
+        c = js[parser->pos];
 
         /* Quote: end of string */
         if (c == '\"') {
@@ -273,10 +435,19 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
                         jsmntok_t *tokens, const unsigned int num_tokens)
 {
     int r;
+#ifndef JSMN_PARENT_LINKS
     int i;
+#endif
     jsmntok_t *token;
     int count = parser->toknext;
 
+#ifdef JSMN_COMPACT_TOKENS
+    /* Offsets must fit in 16 bits, leaving JSMN_POS_UNSET out */
+    if (tokens != NULL && len >= JSMN_POS_UNSET) {
+        return JSMN_ERROR_NOMEM;
+    }
+#endif
+
     for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
         char c;
         jsmntype_t type;
@@ -322,12 +493,16 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
             }
             token = &tokens[parser->toknext - 1];
             for (;;) {
-                if (token->start != -1 && token->end == -1) {
+                if (token->start != JSMN_POS_UNSET && token->end == JSMN_POS_UNSET) {
                     if (token->type != type) {
                         return JSMN_ERROR_INVAL;
                     }
                     token->end = parser->pos + 1;
                     parser->toksuper = token->parent;
+#ifdef JSMN_SIBLING_LINKS
+                    token->next = parser->toknext;
+                    jsmn_link_sibling(parser, tokens);
+#endif
                     break;
                 }
                 if (token->parent == -1) {
@@ -341,7 +516,7 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
 #else
             for (i = parser->toknext - 1; i >= 0; i--) {
                 token = &tokens[i];
-                if (token->start != -1 && token->end == -1) {
+                if (token->start != JSMN_POS_UNSET && token->end == JSMN_POS_UNSET) {
                     if (token->type != type) {
                         return JSMN_ERROR_INVAL;
                     }
@@ -356,7 +531,7 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
             }
             for (; i >= 0; i--) {
                 token = &tokens[i];
-                if (token->start != -1 && token->end == -1) {
+                if (token->start != JSMN_POS_UNSET && token->end == JSMN_POS_UNSET) {
                     parser->toksuper = i;
                     break;
                 }
@@ -371,12 +546,18 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
             count++;
             if (parser->toksuper != -1 && tokens != NULL) {
                 tokens[parser->toksuper].size++;
+#ifdef JSMN_SIBLING_LINKS
+                jsmn_link_sibling(parser, tokens);
+#endif
             }
             break;
         case '\t':
         case '\r':
         case '\n':
         case ' ':
+#ifdef JSMN_FAST_SCAN
+            parser->pos = jsmn_scan_spaces(js, parser->pos + 1, len) - 1;
+#endif
             break;
         case ':':
             parser->toksuper = parser->toknext - 1;
@@ -390,7 +571,7 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
 #else
                 for (i = parser->toknext - 1; i >= 0; i--) {
                     if (tokens[i].type == JSMN_ARRAY || tokens[i].type == JSMN_OBJECT) {
-                        if (tokens[i].start != -1 && tokens[i].end == -1) {
+                        if (tokens[i].start != JSMN_POS_UNSET && tokens[i].end == JSMN_POS_UNSET) {
                             parser->toksuper = i;
                             break;
                         }
@@ -434,6 +615,9 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
             count++;
             if (parser->toksuper != -1 && tokens != NULL) {
                 tokens[parser->toksuper].size++;
+#ifdef JSMN_SIBLING_LINKS
+                jsmn_link_sibling(parser, tokens);
+#endif
             }
             break;
 
@@ -446,12 +630,20 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
     }
 
     if (tokens != NULL) {
+#ifdef JSMN_PARENT_LINKS
+        /* toksuper only falls back to -1 once every container is closed, so
+         * resuming a stream doesn't rescan the whole token array per chunk */
+        if (parser->toksuper != -1) {
+            return JSMN_ERROR_PART;
+        }
+#else
         for (i = parser->toknext - 1; i >= 0; i--) {
             /* Unmatched opened object or array */
-            if (tokens[i].start != -1 && tokens[i].end == -1) {
+            if (tokens[i].start != JSMN_POS_UNSET && tokens[i].end == JSMN_POS_UNSET) {
                 return JSMN_ERROR_PART;
             }
         }
+#endif
     }
 
     return count;
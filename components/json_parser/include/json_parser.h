@@ -17,8 +17,13 @@
 #define _JSON_PARSER_H_
 
 #define JSMN_PARENT_LINKS
+/* json_skip_elem() and the iterators rely on them, they aren't optional */
+#ifndef JSMN_SIBLING_LINKS
+#define JSMN_SIBLING_LINKS
+#endif
 #define JSMN_HEADER
 #include <jsmn.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -33,19 +38,243 @@ extern "C"
 typedef jsmn_parser json_parser_t;
 typedef jsmntok_t json_tok_t;
 
+typedef struct {
+    char *buf;          /* destination of the fed bytes, kept NUL terminated */
+    int size;           /* capacity of buf, including the NUL */
+    int len;            /* bytes stored in buf */
+    int max_strlen;     /* longer strings are truncated, 0 means no limit */
+    int str_len;        /* bytes kept of the current string, -1 outside strings */
+    uint8_t escape;     /* bytes still pending of the current escape sequence */
+    bool skippable;     /* current string is a member value, so it can be cut */
+    bool skipping;      /* current string reached max_strlen */
+    int status;         /* last jsmn_parse result, or an error */
+} json_stream_t;
+
+#define JSON_KEY_INDEX_OBJECTS  4   /* objects indexed at the same time */
+#define JSON_KEY_INDEX_SLOTS    64  /* hash slots per object, power of two */
+#define JSON_KEY_INDEX_MIN_KEYS 8   /* smaller objects are scanned linearly */
+
+/* Open-addressed hash tables of object keys, built the first time an object
+ * is searched. Objects with more than half JSON_KEY_INDEX_SLOTS members
+ * aren't indexed. */
+typedef struct {
+    int obj[JSON_KEY_INDEX_OBJECTS];                            /* object token, -1 if unused */
+    uint16_t slots[JSON_KEY_INDEX_OBJECTS][JSON_KEY_INDEX_SLOTS]; /* key token + 1, 0 if empty */
+    uint8_t victim;                                             /* next entry to replace */
+} json_key_index_t;
+
+/* A string of the parsed data, not NUL terminated. Its escapes are only
+ * decoded once json_parse_unescape() has been called. */
+typedef struct {
+    const char *str;
+    int len;
+} json_str_t;
+
+typedef enum {
+    JSON_FIELD_STRING,      /* copied into a char array member */
+    JSON_FIELD_DUP_STRING,  /* char * member, allocated with malloc() */
+    JSON_FIELD_STR_VIEW,    /* json_str_t member, points into the parsed data */
+    JSON_FIELD_INT,
+    JSON_FIELD_INT64,
+    JSON_FIELD_BOOL,
+    JSON_FIELD_FLOAT,
+} json_field_type_t;
+
+/* Describes a value to extract: its path from the cursor's object (keys
+ * separated by '.') and where to store it in the destination struct. Tables
+ * of fields are meant to be static const, so they stay in flash. */
+typedef struct {
+    const char *path;
+    json_field_type_t type;
+    uint16_t offset;
+    uint16_t size;
+} json_field_t;
+
+#define JSON_FIELD(path, type, st, member) \
+    { (path), (type), offsetof(st, member), sizeof(((st *)0)->member) }
+
+#define JSON_EXTRACT_MAX_FIELDS 32
+
+typedef enum {
+    JSON_SAX_OBJECT_START,
+    JSON_SAX_OBJECT_END,
+    JSON_SAX_ARRAY_START,
+    JSON_SAX_ARRAY_END,
+    JSON_SAX_KEY,
+    JSON_SAX_STRING,        /* str is the raw content, escapes aren't decoded */
+    JSON_SAX_PRIMITIVE,     /* number, true, false or null */
+} json_sax_event_t;
+
+typedef struct {
+    json_sax_event_t type;
+    const char *str;    /* key or value, not NUL terminated, NULL for containers */
+    int len;
+    int depth;          /* nesting of the element, 0 for the root */
+} json_sax_evt_t;
+
+typedef enum {
+    JSON_SAX_DONE = 0,              /* the root element is complete */
+    JSON_SAX_PART = -1,             /* more bytes are needed */
+    JSON_SAX_ERROR_INVAL = -2,      /* not valid JSON */
+    JSON_SAX_ERROR_DEPTH = -3,      /* nested deeper than JSON_SAX_MAX_DEPTH */
+    JSON_SAX_ERROR_STOPPED = -4,    /* the callback ended the parse */
+} json_sax_status_t;
+
+#define JSON_SAX_MAX_DEPTH 16
+#define JSON_SAX_SKIP       2   /* see json_sax_cb_t */
+
+typedef struct json_sax json_sax_t;
+
+/* Return OS_SUCCESS to go on, anything else stops the parse. Returned for an
+ * OBJECT_START or ARRAY_START event, JSON_SAX_SKIP jumps to the end of the
+ * container: its content isn't reported, nor checked beyond its brackets. */
+typedef int (*json_sax_cb_t)(json_sax_t *sax, const json_sax_evt_t *evt, void *arg);
+
+/* Event (SAX) parser: no token is stored, elements are reported as they are
+ * scanned. Like jsmn it can be resumed when more bytes are appended to js. */
+struct json_sax {
+    json_sax_cb_t cb;   /* NULL only validates the input */
+    void *arg;
+    const char *js;
+    int len;
+    int pos;            /* next byte to scan */
+    int depth;          /* open containers */
+    int cur_depth;      /* depth of the element being reported */
+    uint32_t arrays;    /* bit set per depth whose container is an array */
+    int skip;           /* open brackets of the container being skipped */
+    uint8_t expect;
+    json_sax_status_t status;
+    struct {
+        int key;        /* offset of the member name, -1 for array elements */
+        int len;
+    } path[JSON_SAX_MAX_DEPTH + 1];
+};
+
+/* Called by the generator with each full buffer, and what's left at the end.
+ * Anything but OS_SUCCESS makes the rest of the generation fail. */
+typedef int (*json_gen_flush_cb_t)(const char *buf, int len, void *priv);
+
+/* Streaming generator: the JSON is written to a small buffer, flushed to the
+ * callback whenever it is full, so its size has no limit. */
+typedef struct {
+    char *buf;
+    int buf_size;
+    int used;                       /* bytes of buf not flushed yet */
+    int len;                        /* bytes generated so far */
+    json_gen_flush_cb_t flush_cb;   /* NULL only counts the bytes */
+    void *priv;
+    bool comma_req;
+    int err;
+} json_gen_str_t;
+
+/* Token storage shared by parse contexts. Tokens are taken from the top and
+ * given back in reverse order, json_tok_arena_reset() frees all of them. */
+typedef struct {
+    json_tok_t *tokens;
+    int size;
+    int used;
+} json_tok_arena_t;
+
 typedef struct {
     json_parser_t parser;
     const char *js;
     json_tok_t *tokens;
     json_tok_t *cur;
     int num_tokens;
+    json_stream_t stream;
+    json_key_index_t *key_index;
+    json_sax_t *sax;
+    json_tok_arena_t *arena;    /* where tokens come from, NULL if the caller provided them */
+    uint8_t tok_owner;          /* who frees the tokens, see json_parse_end_arena() */
+    bool unescaped;             /* strings were decoded in place by json_parse_unescape() */
 } jparse_ctx_t;
 
+#define JSON_PATH_MAX_STEPS     12
+#define JSON_QUERY_MAX_PATHS    32
+
+/* A member of an object, or an element of an array when key is NULL */
+typedef struct {
+    const char *key;    /* not NUL terminated, points into the compiled string */
+    uint16_t key_len;
+    uint16_t index;
+} json_path_step_t;
+
+typedef struct {
+    json_path_step_t steps[JSON_PATH_MAX_STEPS];
+    int num_steps;
+} json_path_t;
+
+/* Cursor over the elements of an array or the members of an object. Each step
+ * is O(1) and moves jctx->cur onto the element (or the member's value). */
+typedef struct {
+    int container;      /* index of the array or object being walked */
+    int next;           /* index of the next element (or key) */
+    int remaining;      /* elements not visited yet */
+    int index;          /* position of the current element */
+    const char *key;    /* name of the current member, not NUL terminated */
+    int key_len;
+} json_iter_t;
+
 int json_parse_start(jparse_ctx_t *jctx, const char *js, int len);
 int json_parse_end(jparse_ctx_t *jctx);
 int json_parse_start_static(jparse_ctx_t *jctx, const char *js, int len, json_tok_t *buffer_tokens, int buffer_tokens_max_count);
 int json_parse_end_static(jparse_ctx_t *jctx);
 
+int json_tok_arena_init(json_tok_arena_t *arena, json_tok_t *tokens, int size);
+int json_tok_arena_reset(json_tok_arena_t *arena);
+
+/* Count the tokens first, then take exactly that many from the arena. If it
+ * is too small the tokens are allocated with malloc() instead, so large data
+ * still parses. Release with json_parse_end_arena(). */
+int json_parse_start_arena(jparse_ctx_t *jctx, const char *js, int len, json_tok_arena_t *arena);
+int json_parse_end_arena(jparse_ctx_t *jctx);
+
+/* Tokenize only what the paths lead to: the elements they end on, with all
+ * their content, and the containers on the way. Other members are left out
+ * of the tree, array elements before an index a path needs are kept empty so
+ * indexes still match. The scan stops as soon as every path is resolved, the
+ * rest of js isn't looked at. Tokens come from the arena, when it's too small
+ * everything is tokenized like json_parse_start_arena() does. Release with
+ * json_parse_end_arena(). */
+int json_parse_start_query(jparse_ctx_t *jctx, const char *js, int len, json_tok_arena_t *arena,
+                           const json_path_t *paths, int num_paths);
+
+/* Incremental parsing: bytes are fed as they arrive (e.g. from an HTTP client)
+ * and tokenized right away. Whitespace outside strings is dropped and string
+ * values longer than max_strlen are cut, so buf only has to hold the data of interest.
+ * Once the last chunk is fed, json_parse_stream_finish() positions the context
+ * at the root and the usual accessors can be used. Release with
+ * json_parse_end_static().
+ *
+ * Without tokens (NULL buffer_tokens) the data is only collected, and run
+ * through the event parser set with json_parse_stream_set_sax(), if any. */
+int json_parse_stream_begin(jparse_ctx_t *jctx, char *buf, int buf_size, json_tok_t *buffer_tokens, int buffer_tokens_max_count);
+int json_parse_stream_set_max_strlen(jparse_ctx_t *jctx, int max_strlen);
+int json_parse_stream_set_sax(jparse_ctx_t *jctx, json_sax_t *sax);
+/* Tokenizes into the free part of the arena, only the tokens used are kept
+ * by json_parse_stream_finish(). When they run out the data is tokenized
+ * again at the end with exactly as many tokens from the heap. Release with
+ * json_parse_end_arena(). */
+int json_parse_stream_begin_arena(jparse_ctx_t *jctx, char *buf, int buf_size, json_tok_arena_t *arena);
+int json_parse_stream_feed(jparse_ctx_t *jctx, const char *data, int len);
+int json_parse_stream_finish(jparse_ctx_t *jctx);
+
+/* The accessors that copy a string decode its escapes, \uXXXX to UTF-8.
+ * Views borrow the parsed data as it is: to get decoded strings without any
+ * copy, decode all of them in place first. js must then be writable, and each
+ * string shrinks into the bytes it used. */
+int json_parse_unescape(jparse_ctx_t *jctx);
+
+/* Decode the escapes of str in place, returns its new length (the result
+ * isn't NUL terminated), or -1 if an escape is invalid */
+int json_str_unescape(char *str, int len);
+
+/* Index the keys of wide objects, must be called after the context is
+ * started. The index is dropped by json_parse_end*(). Building it costs more
+ * than a few lookups save: it only pays off for many lookups on the same
+ * objects, a /me/player state's are faster without it. */
+int json_parse_set_key_index(jparse_ctx_t *jctx, json_key_index_t *index);
+
 int json_obj_get_array(jparse_ctx_t *jctx, const char *name, int *num_elem);
 int json_obj_leave_array(jparse_ctx_t *jctx);
 int json_obj_get_object(jparse_ctx_t *jctx, const char *name);
@@ -55,6 +284,7 @@ int json_obj_get_int(jparse_ctx_t *jctx, const char *name, int *val);
 int json_obj_get_int64(jparse_ctx_t *jctx, const char *name, int64_t *val);
 int json_obj_get_float(jparse_ctx_t *jctx, const char *name, float *val);
 int json_obj_get_string(jparse_ctx_t *jctx, const char *name, char *val, int size);
+int json_obj_get_strview(jparse_ctx_t *jctx, const char *name, json_str_t *val);
 int json_obj_match_string(jparse_ctx_t* jctx, const char* name, const char* str, bool* val);
 int json_obj_dup_string(jparse_ctx_t* jctx, const char* name, char** str);
 int json_obj_get_strlen(jparse_ctx_t *jctx, const char *name, int *strlen);
@@ -72,8 +302,131 @@ int json_arr_get_int(jparse_ctx_t *jctx, uint32_t index, int *val);
 int json_arr_get_int64(jparse_ctx_t *jctx, uint32_t index, int64_t *val);
 int json_arr_get_float(jparse_ctx_t *jctx, uint32_t index, float *val);
 int json_arr_get_string(jparse_ctx_t *jctx, uint32_t index, char *val, int size);
+int json_arr_get_strview(jparse_ctx_t *jctx, uint32_t index, json_str_t *val);
 int json_arr_get_strlen(jparse_ctx_t *jctx, uint32_t index, int *strlen);
 
+/* Fill every field of the table in a single pass over the tokens of the object
+ * the cursor is on. The first occurrence of each path is taken and the pass
+ * ends as soon as all fields are found. Returns OS_SUCCESS if all of them were
+ * found, found (optional) gets a bit set per extracted field. */
+int json_obj_extract(jparse_ctx_t *jctx, const json_field_t *fields, int num_fields, void *dest, uint32_t *found);
+
+/* Paths are member names separated by '.' with array indexes in brackets,
+ * e.g. "item.album.images[1].url". The compiled path points into str, which
+ * must outlive it (a string literal does). */
+int json_path_compile(json_path_t *path, const char *str);
+
+/* Move the cursor onto the element the path leads to from the cursor, to read
+ * it with json_cur_get_*() or go on from there. If it isn't found the cursor
+ * stays where it was. */
+int json_path_find(jparse_ctx_t *jctx, const json_path_t *path);
+
+/* Find many paths from the cursor, which doesn't move. Steps a path shares
+ * with the previous one aren't walked again, so paths with a common prefix
+ * should be listed together. elems[i] is the element of paths[i] (NULL if
+ * not found), point jctx->cur to it to read it. Returns OS_SUCCESS if every
+ * path was found. */
+int json_path_find_batch(jparse_ctx_t *jctx, const json_path_t *paths, int num_paths, json_tok_t **elems);
+
+/* Quick lookup in raw bytes, e.g. to check a message before parsing it: the
+ * path is followed from the element at offset from (0 for the root) without
+ * tokenizing nor validating anything but quotes and brackets. tok gets the
+ * type and bounds of the element found, except the end of an object or an
+ * array which would take scanning all of it. To read it, point the cursor of
+ * a context whose js is the same to tok:
+ *
+ *     jparse_ctx_t raw = { .js = js, .cur = &tok };
+ *     json_cur_get_int(&raw, &val);
+ */
+int json_raw_find(const char *js, int len, int from, const json_path_t *path, json_tok_t *tok);
+
+/* Same for many paths, found in a single pass that ends as soon as all of
+ * them are. toks[i] is the element of paths[i], its type is JSMN_UNDEFINED if
+ * it wasn't found. Returns OS_SUCCESS if every path was found. */
+int json_raw_find_batch(const char *js, int len, int from, const json_path_t *paths, int num_paths, json_tok_t *toks);
+
+/* Walk the array (or object) the cursor is on:
+ *
+ *     json_iter_t it;
+ *     json_arr_iter_begin(jctx, &it);
+ *     while (json_arr_iter_next(jctx, &it) == OS_SUCCESS) {
+ *         json_obj_get_string(jctx, "name", ...);
+ *     }
+ *
+ * When there are no elements left, the cursor is put back on the container. */
+int json_arr_iter_begin(jparse_ctx_t *jctx, json_iter_t *iter);
+int json_arr_iter_next(jparse_ctx_t *jctx, json_iter_t *iter);
+int json_obj_iter_begin(jparse_ctx_t *jctx, json_iter_t *iter);
+int json_obj_iter_next(jparse_ctx_t *jctx, json_iter_t *iter);
+
+/* Event parsing. js holds all the bytes received so far and must stay in
+ * place until the parse ends, json_sax_feed() resumes where it stopped.
+ * json_sax_finish() returns OS_SUCCESS once the root element is complete. */
+int json_sax_begin(json_sax_t *sax, json_sax_cb_t cb, void *arg);
+int json_sax_feed(json_sax_t *sax, const char *js, int len);
+int json_sax_finish(json_sax_t *sax);
+int json_sax_parse(const char *js, int len, json_sax_cb_t cb, void *arg);
+
+/* From a callback: check the path of the element being reported, relative to
+ * its ancestor at depth (0 for the root). Members are separated by '.' and
+ * array elements are written "[]", e.g. "item.artists[].name". */
+bool json_sax_path_match(const json_sax_t *sax, int depth, const char *path);
+
+/* Same as json_obj_extract(), without tokens. Paths are relative to the
+ * first object found at root ("[]" allowed, NULL for the root) and the
+ * parse stops as soon as every field is found. */
+int json_sax_extract(const char *js, int len, const char *root, const json_field_t *fields, int num_fields,
+                     void *dest, uint32_t *found);
+
+/* From a callback: store the STRING or PRIMITIVE being reported into dest as
+ * the field says, for callbacks that extract along with their own work. Any
+ * other event fails, dest untouched. */
+int json_sax_field_store(json_sax_t *sax, const json_sax_evt_t *evt, const json_field_t *field, void *dest);
+
+/* Read the element the cursor is on */
+int json_cur_get_bool(jparse_ctx_t *jctx, bool *val);
+int json_cur_get_int(jparse_ctx_t *jctx, int *val);
+int json_cur_get_int64(jparse_ctx_t *jctx, int64_t *val);
+int json_cur_get_float(jparse_ctx_t *jctx, float *val);
+int json_cur_get_string(jparse_ctx_t *jctx, char *val, int size);
+int json_cur_get_strview(jparse_ctx_t *jctx, json_str_t *val);
+int json_cur_get_strlen(jparse_ctx_t *jctx, int *strlen);
+
+/* Generate JSON. Names are only given to members of objects, strings are
+ * escaped. Without a flush callback nothing is written, the generation only
+ * gives its length in jstr->len, e.g. to send it with a Content-Length: the
+ * same calls made again with a callback produce exactly that many bytes.
+ *
+ *     json_gen_str_start(&jstr, buf, sizeof(buf), write_cb, conn);
+ *     json_gen_start_object(&jstr);
+ *     json_gen_push_array(&jstr, "uris");
+ *     json_gen_arr_set_string(&jstr, "spotify:track:...");
+ *     json_gen_pop_array(&jstr);
+ *     json_gen_obj_set_int(&jstr, "position_ms", 0);
+ *     json_gen_end_object(&jstr);
+ *     err = json_gen_str_end(&jstr);
+ *
+ * Every call returns OS_SUCCESS, or -OS_FAIL from the first failed flush on.
+ * json_gen_str_end() flushes what's left. */
+void json_gen_str_start(json_gen_str_t *jstr, char *buf, int buf_size, json_gen_flush_cb_t flush_cb, void *priv);
+int json_gen_str_end(json_gen_str_t *jstr);
+int json_gen_start_object(json_gen_str_t *jstr);
+int json_gen_end_object(json_gen_str_t *jstr);
+int json_gen_start_array(json_gen_str_t *jstr);
+int json_gen_end_array(json_gen_str_t *jstr);
+int json_gen_push_object(json_gen_str_t *jstr, const char *name);
+int json_gen_pop_object(json_gen_str_t *jstr);
+int json_gen_push_array(json_gen_str_t *jstr, const char *name);
+int json_gen_pop_array(json_gen_str_t *jstr);
+int json_gen_obj_set_bool(json_gen_str_t *jstr, const char *name, bool val);
+int json_gen_obj_set_int(json_gen_str_t *jstr, const char *name, int64_t val);
+int json_gen_obj_set_string(json_gen_str_t *jstr, const char *name, const char *val);
+int json_gen_obj_set_null(json_gen_str_t *jstr, const char *name);
+int json_gen_arr_set_bool(json_gen_str_t *jstr, bool val);
+int json_gen_arr_set_int(json_gen_str_t *jstr, int64_t val);
+int json_gen_arr_set_string(json_gen_str_t *jstr, const char *val);
+int json_gen_arr_set_null(json_gen_str_t *jstr);
+
 #ifdef __cplusplus
 }
 #endif
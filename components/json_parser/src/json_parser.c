@@ -14,31 +14,52 @@
  *   limitations under the License.
  */
 #include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
 #define JSMN_PARENT_LINKS
+/* json_skip_elem() and the iterators rely on them, they aren't optional */
+#ifndef JSMN_SIBLING_LINKS
+#define JSMN_SIBLING_LINKS
+#endif
 #define JSMN_STRICT
 #define JSMN_STATIC
 #include <jsmn.h>
 #include <json_parser.h>
 
+typedef struct {
+    const char *str;
+    int len;
+} json_key_t;
+
+static bool token_matches_key(jparse_ctx_t *ctx, json_tok_t *tok, const json_key_t *key)
+{
+    return ((tok->end - tok->start) == key->len)
+           && (memcmp(ctx->js + tok->start, key->str, key->len) == 0);
+}
+
 static bool token_matches_str(jparse_ctx_t *ctx, json_tok_t *tok, const char *str)
 {
-    const char *js = ctx->js;
-    return ((strncmp(js + tok->start, str, strlen(str)) == 0)
-            && (strlen(str) == (size_t) (tok->end - tok->start)));
+    json_key_t key = { str, strlen(str) };
+    return token_matches_key(ctx, tok, &key);
 }
 
-static json_tok_t *json_skip_elem(json_tok_t *token)
+/* Only the length and three chars are hashed, so hashing a token is O(1) */
+static uint32_t json_key_hash(const char *str, int len)
 {
-    json_tok_t *cur = token;
-    int cnt = cur->size;
-    while (cnt--) {
-        cur++;
-        cur = json_skip_elem(cur);
+    if (len == 0) {
+        return 0;
     }
-    return cur;
+    return (len * 31u) ^ ((unsigned char) str[0] * 131u) ^
+           ((unsigned char) str[len / 2] * 17u) ^ ((unsigned char) str[len - 1] * 7u);
+}
+
+/* Last token of the element's subtree, its next sibling comes right after */
+static json_tok_t *json_skip_elem(jparse_ctx_t *jctx, json_tok_t *token)
+{
+    return &jctx->tokens[token->next - 1];
 }
 
 static int json_tok_to_bool(jparse_ctx_t *jctx, json_tok_t *tok, bool *val)
@@ -92,19 +113,191 @@ static int json_tok_to_float(jparse_ctx_t *jctx, json_tok_t *tok, float *val)
     return -OS_FAIL;
 }
 
+static int json_hex4(const char *str, int len, uint32_t *val)
+{
+    if (len < 4) {
+        return -OS_FAIL;
+    }
+    *val = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = str[i];
+        int digit = (c >= '0' && c <= '9') ? c - '0' :
+                    (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                    (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if (digit < 0) {
+            return -OS_FAIL;
+        }
+        *val = (*val << 4) | digit;
+    }
+    return OS_SUCCESS;
+}
+
+/* Decode the escapes of src into at most size bytes of dst, which can be src
+ * itself since no escape is shorter than its UTF-8. A surrogate that isn't
+ * part of a pair becomes U+FFFD. Returns the decoded length, or -1. */
+static int json_unescape(char *dst, int size, const char *src, int len)
+{
+    int out = 0;
+    for (int i = 0; i < len; i++) {
+        char c = src[i];
+        if (c != '\\') {
+            if (out >= size) {
+                return -1;
+            }
+            dst[out++] = c;
+            continue;
+        }
+        if (++i == len) {
+            return -1;
+        }
+        uint32_t cp;
+        switch (src[i]) {
+        case '"': case '\\': case '/':
+            cp = src[i];
+            break;
+        case 'b':
+            cp = '\b';
+            break;
+        case 'f':
+            cp = '\f';
+            break;
+        case 'n':
+            cp = '\n';
+            break;
+        case 'r':
+            cp = '\r';
+            break;
+        case 't':
+            cp = '\t';
+            break;
+        case 'u':
+            if (json_hex4(src + i + 1, len - i - 1, &cp) != OS_SUCCESS) {
+                return -1;
+            }
+            i += 4;
+            if (cp >= 0xD800 && cp < 0xDC00) {
+                uint32_t low;
+                if (i + 2 < len && src[i + 1] == '\\' && src[i + 2] == 'u' &&
+                    json_hex4(src + i + 3, len - i - 3, &low) == OS_SUCCESS && low >= 0xDC00 && low < 0xE000) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    i += 6;
+                } else {
+                    cp = 0xFFFD;
+                }
+            } else if (cp >= 0xDC00 && cp < 0xE000) {
+                cp = 0xFFFD;
+            }
+            break;
+        default:
+            return -1;
+        }
+
+        int n = (cp < 0x80) ? 1 : (cp < 0x800) ? 2 : (cp < 0x10000) ? 3 : 4;
+        if (out + n > size) {
+            return -1;
+        }
+        if (n == 1) {
+            dst[out++] = cp;
+            continue;
+        }
+        static const uint8_t lead[] = { 0, 0, 0xC0, 0xE0, 0xF0 };
+        for (int k = n - 1; k > 0; k--) {
+            dst[out + k] = 0x80 | (cp & 0x3F);
+            cp >>= 6;
+        }
+        dst[out] = lead[n] | cp;
+        out += n;
+    }
+    return out;
+}
+
+/* Strings are decoded unless json_parse_unescape() already did it in place */
 static int json_tok_to_string(jparse_ctx_t *jctx, json_tok_t *tok, char *val, int size)
 {
-    if ((tok->end - tok->start) > (size - 1)) {
+    const char *str = jctx->js + tok->start;
+    int len = tok->end - tok->start;
+    if (size <= 0) {
         return -OS_FAIL;
     }
-    strncpy(val, jctx->js + tok->start, tok->end - tok->start);
-    val[tok->end - tok->start] = 0;
+    if (tok->type == JSMN_STRING && !jctx->unescaped && memchr(str, '\\', len)) {
+        len = json_unescape(val, size - 1, str, len);
+        if (len < 0) {
+            return -OS_FAIL;
+        }
+    } else {
+        if (len > (size - 1)) {
+            return -OS_FAIL;
+        }
+        memcpy(val, str, len);
+    }
+    val[len] = 0;
     return OS_SUCCESS;
 }
 
-static json_tok_t *json_obj_search(jparse_ctx_t *jctx, const char *key)
+static void json_tok_to_strview(jparse_ctx_t *jctx, json_tok_t *tok, json_str_t *val)
+{
+    val->str = jctx->js + tok->start;
+    val->len = tok->end - tok->start;
+}
+
+/* Slots of the object's index, building it if the object isn't indexed yet */
+static uint16_t *json_key_index_get(jparse_ctx_t *jctx, json_tok_t *obj)
+{
+    json_key_index_t *index = jctx->key_index;
+    int obj_idx = obj - jctx->tokens;
+    for (int i = 0; i < JSON_KEY_INDEX_OBJECTS; i++) {
+        if (index->obj[i] == obj_idx) {
+            return index->slots[i];
+        }
+    }
+    if (obj->size > JSON_KEY_INDEX_SLOTS / 2) {
+        return NULL;
+    }
+
+    uint16_t *slots = index->slots[index->victim];
+    index->obj[index->victim] = obj_idx;
+    index->victim = (index->victim + 1) % JSON_KEY_INDEX_OBJECTS;
+    memset(slots, 0, sizeof(index->slots[0]));
+
+    json_tok_t *key = obj + 1;
+    for (int n = 0; n < obj->size; n++) {
+        uint32_t slot = json_key_hash(jctx->js + key->start, key->end - key->start);
+        while (slots[slot % JSON_KEY_INDEX_SLOTS]) {
+            slot++;
+        }
+        slots[slot % JSON_KEY_INDEX_SLOTS] = (key - jctx->tokens) + 1;
+        key = &jctx->tokens[key->next];
+    }
+    return slots;
+}
+
+static json_tok_t *json_key_index_find(jparse_ctx_t *jctx, uint16_t *slots, const json_key_t *key)
+{
+    uint32_t slot = json_key_hash(key->str, key->len);
+    /* The table is at most half full, there is always an empty slot */
+    while (slots[slot % JSON_KEY_INDEX_SLOTS]) {
+        json_tok_t *tok = &jctx->tokens[slots[slot % JSON_KEY_INDEX_SLOTS] - 1];
+        if (token_matches_key(jctx, tok, key)) {
+            return tok;
+        }
+        slot++;
+    }
+    return NULL;
+}
+
+static int json_tok_dup_string(jparse_ctx_t *jctx, json_tok_t *tok, char **str)
+{
+    int size = tok->end - tok->start + 1;
+    *str = malloc(size);
+    if (!*str) {
+        return -OS_FAIL;
+    }
+    return json_tok_to_string(jctx, tok, *str, size);
+}
+
+/* Key token of the object's member, NULL if there is no such member */
+static json_tok_t *json_obj_find_key(jparse_ctx_t *jctx, json_tok_t *tok, const json_key_t *key)
 {
-    json_tok_t *tok = jctx->cur;
     int size = tok->size;
     if (size <= 0) {
         return NULL;
@@ -113,16 +306,29 @@ static json_tok_t *json_obj_search(jparse_ctx_t *jctx, const char *key)
         return NULL;
     }
 
+    if (jctx->key_index && size >= JSON_KEY_INDEX_MIN_KEYS) {
+        uint16_t *slots = json_key_index_get(jctx, tok);
+        if (slots) {
+            return json_key_index_find(jctx, slots, key);
+        }
+    }
+
     while (size--) {
         tok++;
-        if (token_matches_str(jctx, tok, key)) {
+        if (token_matches_key(jctx, tok, key)) {
             return tok;
         }
-        tok = json_skip_elem(tok);
+        tok = json_skip_elem(jctx, tok);
     }
     return NULL;
 }
 
+static json_tok_t *json_obj_search(jparse_ctx_t *jctx, const char *name)
+{
+    json_key_t key = { name, strlen(name) };
+    return json_obj_find_key(jctx, jctx->cur, &key);
+}
+
 static json_tok_t *json_obj_get_val_tok(jparse_ctx_t *jctx, const char *name, jsmntype_t type)
 {
     json_tok_t *tok = json_obj_search(jctx, name);
@@ -240,12 +446,17 @@ int json_obj_dup_string(jparse_ctx_t* jctx, const char* name, char** str)
     if (!tok) {
         return -OS_FAIL;
     }
-    int size = tok->end - tok->start + 1;
-    *str = malloc(size);
-    if (!*str) {
+    return json_tok_dup_string(jctx, tok, str);
+}
+
+int json_obj_get_strview(jparse_ctx_t *jctx, const char *name, json_str_t *val)
+{
+    json_tok_t *tok = json_obj_get_val_tok(jctx, name, JSMN_STRING);
+    if (!tok) {
         return -OS_FAIL;
     }
-    return json_tok_to_string(jctx, tok, *str, size);
+    json_tok_to_strview(jctx, tok, val);
+    return OS_SUCCESS;
 }
 
 int json_obj_match_string(jparse_ctx_t* jctx, const char* name, const char* str, bool* val)
@@ -305,9 +516,8 @@ int json_obj_get_array_strlen(jparse_ctx_t *jctx, const char *name, int *strlen)
     return OS_SUCCESS;
 }
 
-static json_tok_t *json_arr_search(jparse_ctx_t *ctx, uint32_t index)
+static json_tok_t *json_arr_find_elem(jparse_ctx_t *ctx, json_tok_t *tok, uint32_t index)
 {
-    json_tok_t *tok = ctx->cur;
     if ((tok->type != JSMN_ARRAY) || (tok->size <= 0)) {
         return NULL;
     }
@@ -317,11 +527,16 @@ static json_tok_t *json_arr_search(jparse_ctx_t *ctx, uint32_t index)
     /* Increment by 1, so that token points to index 0 */
     tok++;
     while (index--) {
-        tok = json_skip_elem(tok);
+        tok = json_skip_elem(ctx, tok);
         tok++;
     }
     return tok;
 }
+
+static json_tok_t *json_arr_search(jparse_ctx_t *ctx, uint32_t index)
+{
+    return json_arr_find_elem(ctx, ctx->cur, index);
+}
 static json_tok_t *json_arr_get_val_tok(jparse_ctx_t *jctx, uint32_t index, jsmntype_t type)
 {
     json_tok_t *tok = json_arr_search(jctx, index);
@@ -417,6 +632,16 @@ int json_arr_get_string(jparse_ctx_t *jctx, uint32_t index, char *val, int size)
     return json_tok_to_string(jctx, tok, val, size);
 }
 
+int json_arr_get_strview(jparse_ctx_t *jctx, uint32_t index, json_str_t *val)
+{
+    json_tok_t *tok = json_arr_get_val_tok(jctx, index, JSMN_STRING);
+    if (!tok) {
+        return -OS_FAIL;
+    }
+    json_tok_to_strview(jctx, tok, val);
+    return OS_SUCCESS;
+}
+
 int json_arr_get_strlen(jparse_ctx_t *jctx, uint32_t index, int *strlen)
 {
     json_tok_t *tok = json_arr_get_val_tok(jctx, index, JSMN_STRING);
@@ -427,72 +652,1722 @@ int json_arr_get_strlen(jparse_ctx_t *jctx, uint32_t index, int *strlen)
     return OS_SUCCESS;
 }
 
-int json_parse_start(jparse_ctx_t *jctx, const char *js, int len)
+static int json_field_store(jparse_ctx_t *jctx, json_tok_t *tok, const json_field_t *field, void *dest)
 {
-    memset(jctx, 0, sizeof(jparse_ctx_t));
-    jsmn_init(&jctx->parser);
-    int num_tokens = jsmn_parse(&jctx->parser, js, len, NULL, 0);
-    if (num_tokens <= 0) {
+    void *dst = (char *) dest + field->offset;
+    jsmntype_t type = (field->type == JSON_FIELD_STRING || field->type == JSON_FIELD_DUP_STRING ||
+                       field->type == JSON_FIELD_STR_VIEW) ? JSMN_STRING : JSMN_PRIMITIVE;
+    if (tok->type != type) {
         return -OS_FAIL;
     }
-    jctx->num_tokens = num_tokens;
-    jctx->tokens = calloc(num_tokens, sizeof(json_tok_t));
-    if (!jctx->tokens) {
+    switch (field->type) {
+    case JSON_FIELD_STRING:
+        return json_tok_to_string(jctx, tok, dst, field->size);
+    case JSON_FIELD_DUP_STRING:
+        return (field->size == sizeof(char *)) ? json_tok_dup_string(jctx, tok, dst) : -OS_FAIL;
+    case JSON_FIELD_STR_VIEW:
+        if (field->size != sizeof(json_str_t)) {
+            return -OS_FAIL;
+        }
+        json_tok_to_strview(jctx, tok, dst);
+        return OS_SUCCESS;
+    case JSON_FIELD_INT:
+        return (field->size == sizeof(int)) ? json_tok_to_int(jctx, tok, dst) : -OS_FAIL;
+    case JSON_FIELD_INT64:
+        return (field->size == sizeof(int64_t)) ? json_tok_to_int64(jctx, tok, dst) : -OS_FAIL;
+    case JSON_FIELD_BOOL:
+        return (field->size == sizeof(bool)) ? json_tok_to_bool(jctx, tok, dst) : -OS_FAIL;
+    case JSON_FIELD_FLOAT:
+        return (field->size == sizeof(float)) ? json_tok_to_float(jctx, tok, dst) : -OS_FAIL;
+    default:
         return -OS_FAIL;
     }
-    jctx->js = js;
-    jsmn_init(&jctx->parser);
-    int ret = jsmn_parse(&jctx->parser, js, len, jctx->tokens, jctx->num_tokens);
-    if (ret <= 0) {
-        free(jctx->tokens);
-        memset(jctx, 0, sizeof(jparse_ctx_t));
+}
+
+/* seg[i] points to the part of fields[i].path still to be matched, the fields
+ * in active share the path leading to obj */
+static uint32_t json_extract_obj(jparse_ctx_t *jctx, json_tok_t *obj, const json_field_t *fields,
+                                 const char **seg, uint32_t active, void *dest)
+{
+    uint32_t found = 0;
+    json_tok_t *key = obj + 1;
+    for (int n = 0; n < obj->size && active; n++, key = &jctx->tokens[key->next]) {
+        json_tok_t *val = key + 1;
+        int key_len = key->end - key->start;
+        uint32_t nested = 0;
+        for (uint32_t pending = active; pending; pending &= pending - 1) {
+            int i = __builtin_ctz(pending);
+            const char *dot = strchr(seg[i], '.');
+            int seg_len = dot ? dot - seg[i] : (int) strlen(seg[i]);
+            if (seg_len != key_len || memcmp(seg[i], jctx->js + key->start, key_len) != 0) {
+                continue;
+            }
+            if (!dot) {
+                if (json_field_store(jctx, val, &fields[i], dest) == OS_SUCCESS) {
+                    found |= 1u << i;
+                }
+                active &= ~(1u << i);
+            } else if (val->type == JSMN_OBJECT) {
+                seg[i] = dot + 1;
+                nested |= 1u << i;
+            } else {
+                active &= ~(1u << i);
+            }
+        }
+        if (nested) {
+            found |= json_extract_obj(jctx, val, fields, seg, nested, dest);
+            active &= ~nested;
+        }
+    }
+    return found;
+}
+
+int json_obj_extract(jparse_ctx_t *jctx, const json_field_t *fields, int num_fields, void *dest, uint32_t *found)
+{
+    const char *seg[JSON_EXTRACT_MAX_FIELDS];
+    if (jctx->cur->type != JSMN_OBJECT || num_fields <= 0 || num_fields > JSON_EXTRACT_MAX_FIELDS) {
         return -OS_FAIL;
     }
-    jctx->cur = jctx->tokens;
-    return OS_SUCCESS;
+    for (int i = 0; i < num_fields; i++) {
+        seg[i] = fields[i].path;
+    }
+    uint32_t all = (num_fields == 32) ? UINT32_MAX : (1u << num_fields) - 1;
+    uint32_t extracted = json_extract_obj(jctx, jctx->cur, fields, seg, all, dest);
+    if (found) {
+        *found = extracted;
+    }
+    return (extracted == all) ? OS_SUCCESS : -OS_FAIL;
 }
 
-int json_parse_end(jparse_ctx_t *jctx)
+int json_path_compile(json_path_t *path, const char *str)
 {
-    if (jctx->tokens) {
-        free(jctx->tokens);
+    memset(path, 0, sizeof(json_path_t));
+    const char *p = str;
+    while (*p) {
+        if (path->num_steps == JSON_PATH_MAX_STEPS) {
+            return -OS_FAIL;
+        }
+        json_path_step_t *step = &path->steps[path->num_steps++];
+        if (*p == '[') {
+            char *end;
+            unsigned long index = strtoul(p + 1, &end, 10);
+            if (end == p + 1 || *end != ']' || index > UINT16_MAX) {
+                return -OS_FAIL;
+            }
+            step->index = index;
+            p = end + 1;
+            if (*p && *p != '.' && *p != '[') {
+                return -OS_FAIL;
+            }
+        } else {
+            size_t len = strcspn(p, ".[");
+            if (len == 0 || len > UINT16_MAX) {
+                return -OS_FAIL;
+            }
+            step->key = p;
+            step->key_len = len;
+            p += len;
+        }
+        if (*p == '.' && *(++p) == 0) {
+            return -OS_FAIL;
+        }
     }
-    memset(jctx, 0, sizeof(jparse_ctx_t));
     return OS_SUCCESS;
 }
 
-int json_parse_start_static(jparse_ctx_t *jctx, const char *js, int len, json_tok_t *buffer_tokens, int buffer_tokens_max_count)
+static json_tok_t *json_path_step(jparse_ctx_t *jctx, json_tok_t *tok, const json_path_step_t *step)
 {
-    // Init
-    memset(buffer_tokens, 0, buffer_tokens_max_count * sizeof(json_tok_t));
-    memset(jctx, 0, sizeof(jparse_ctx_t));
+    if (!step->key) {
+        return json_arr_find_elem(jctx, tok, step->index);
+    }
+    json_key_t key = { step->key, step->key_len };
+    json_tok_t *key_tok = json_obj_find_key(jctx, tok, &key);
+    return key_tok ? key_tok + 1 : NULL;
+}
 
-    // Check fit
-    jsmn_init(&jctx->parser);
-    int num_tokens = jsmn_parse(&jctx->parser, js, len, NULL, 0);
-    if (num_tokens <= 0 || num_tokens > buffer_tokens_max_count) {
+static bool json_path_step_equal(const json_path_step_t *a, const json_path_step_t *b)
+{
+    if (!a->key || !b->key) {
+        return !a->key && !b->key && a->index == b->index;
+    }
+    return a->key_len == b->key_len && memcmp(a->key, b->key, a->key_len) == 0;
+}
+
+int json_path_find_batch(jparse_ctx_t *jctx, const json_path_t *paths, int num_paths, json_tok_t **elems)
+{
+    /* trail[d] is where the previous path got after d steps */
+    json_tok_t *trail[JSON_PATH_MAX_STEPS + 1];
+    int resolved = 0;
+    int found = 0;
+    trail[0] = jctx->cur;
+    for (int i = 0; i < num_paths; i++) {
+        const json_path_t *path = &paths[i];
+        int d = 0;
+        while (i > 0 && d < resolved && d < path->num_steps &&
+                json_path_step_equal(&paths[i - 1].steps[d], &path->steps[d])) {
+            d++;
+        }
+        for (; d < path->num_steps; d++) {
+            trail[d + 1] = json_path_step(jctx, trail[d], &path->steps[d]);
+            if (!trail[d + 1]) {
+                break;
+            }
+        }
+        resolved = d;
+        elems[i] = (d == path->num_steps) ? trail[d] : NULL;
+        if (elems[i]) {
+            found++;
+        }
+    }
+    return (found == num_paths) ? OS_SUCCESS : -OS_FAIL;
+}
+
+static int json_raw_skip_spaces(const char *js, int len, int pos)
+{
+    while (pos < len && (js[pos] == ' ' || js[pos] == '\t' || js[pos] == '\r' || js[pos] == '\n')) {
+        pos++;
+    }
+    return pos;
+}
+
+/* Offset of the closing quote of the string opening at pos, len if missing */
+static int json_raw_string_end(const char *js, int len, int pos)
+{
+    for (pos++; pos < len; pos++) {
+#ifdef JSMN_FAST_SCAN
+        pos = jsmn_scan_string(js, pos, len);
+        if (pos == len) {
+            break;
+        }
+#endif
+        if (js[pos] == '\\') {
+            pos++;
+        } else if (js[pos] == '\"') {
+            return pos;
+        }
+    }
+    return len;
+}
+
+/* Offset right after the element at pos, len if it's cut */
+static int json_raw_skip(const char *js, int len, int pos)
+{
+    if (js[pos] == '\"') {
+        return json_raw_string_end(js, len, pos) + 1;
+    }
+    if (js[pos] != '{' && js[pos] != '[') {
+        while (pos < len && js[pos] && !strchr(",]} \t\r\n", js[pos])) {
+            pos++;
+        }
+        return pos;
+    }
+    int depth = 0;
+    for (; pos < len; pos++) {
+        char c = js[pos];
+        if (c == '\"') {
+            pos = json_raw_string_end(js, len, pos);
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if ((c == '}' || c == ']') && --depth == 0) {
+            return pos + 1;
+        }
+    }
+    return len;
+}
+
+typedef struct {
+    const char *js;
+    int len;
+    const json_path_t *paths;
+    json_tok_t *toks;
+    uint32_t pending;       /* paths not found yet */
+} json_raw_t;
+
+static void json_raw_tok(json_raw_t *r, int pos, json_tok_t *tok)
+{
+    const char *js = r->js;
+    memset(tok, 0, sizeof(json_tok_t));
+    tok->parent = -1;
+    if (js[pos] == '{' || js[pos] == '[') {
+        /* Its end would take scanning all of it */
+        tok->type = (js[pos] == '{') ? JSMN_OBJECT : JSMN_ARRAY;
+        tok->start = pos;
+        tok->end = JSMN_POS_UNSET;
+    } else if (js[pos] == '\"') {
+        tok->type = JSMN_STRING;
+        tok->start = pos + 1;
+        tok->end = json_raw_string_end(js, r->len, pos);
+    } else {
+        tok->type = JSMN_PRIMITIVE;
+        tok->start = pos;
+        tok->end = json_raw_skip(js, r->len, pos);
+    }
+}
+
+/* Look for the paths in active, which lead to the container at pos in depth
+ * steps. Returns the offset after the container, -1 once all paths are found */
+static int json_raw_walk(json_raw_t *r, int pos, int depth, uint32_t active)
+{
+    const char *js = r->js;
+    int len = r->len;
+    char close = (js[pos] == '{') ? '}' : ']';
+    int index = 0;
+    pos = json_raw_skip_spaces(js, len, pos + 1);
+    if (pos < len && js[pos] == close) {
+        return pos + 1;
+    }
+    while (pos < len) {
+        uint32_t match = 0;
+        if (close == '}') {
+            int end = json_raw_string_end(js, len, pos);
+            for (uint32_t pending = active; pending; pending &= pending - 1) {
+                int i = __builtin_ctz(pending);
+                const json_path_step_t *step = &r->paths[i].steps[depth];
+                if (step->key && step->key_len == end - pos - 1 && memcmp(step->key, js + pos + 1, step->key_len) == 0) {
+                    match |= 1u << i;
+                }
+            }
+            pos = json_raw_skip_spaces(js, len, end + 1);
+            if (pos >= len || js[pos] != ':') {
+                return len;
+            }
+            pos = json_raw_skip_spaces(js, len, pos + 1);
+            if (pos >= len) {
+                return len;
+            }
+        } else {
+            for (uint32_t pending = active; pending; pending &= pending - 1) {
+                int i = __builtin_ctz(pending);
+                const json_path_step_t *step = &r->paths[i].steps[depth];
+                if (!step->key && step->index == index) {
+                    match |= 1u << i;
+                }
+            }
+            index++;
+        }
+
+        uint32_t deeper = 0;
+        for (uint32_t pending = match; pending; pending &= pending - 1) {
+            int i = __builtin_ctz(pending);
+            if (r->paths[i].num_steps == depth + 1) {
+                json_raw_tok(r, pos, &r->toks[i]);
+                r->pending &= ~(1u << i);
+            } else {
+                deeper |= 1u << i;
+            }
+        }
+        if (!r->pending) {
+            return -1;
+        }
+        if (deeper && (js[pos] == '{' || js[pos] == '[')) {
+            pos = json_raw_walk(r, pos, depth + 1, deeper);
+            if (pos < 0) {
+                return -1;
+            }
+        } else {
+            pos = json_raw_skip(js, len, pos);
+        }
+
+        pos = json_raw_skip_spaces(js, len, pos);
+        if (pos < len && js[pos] == close) {
+            return pos + 1;
+        }
+        if (pos >= len || js[pos] != ',') {
+            return len;
+        }
+        pos = json_raw_skip_spaces(js, len, pos + 1);
+    }
+    return len;
+}
+
+int json_raw_find_batch(const char *js, int len, int from, const json_path_t *paths, int num_paths, json_tok_t *toks)
+{
+    if (num_paths <= 0 || num_paths > JSON_QUERY_MAX_PATHS) {
+        return -OS_FAIL;
+    }
+#ifdef JSMN_COMPACT_TOKENS
+    if (len >= JSMN_POS_UNSET) {
+        return -OS_FAIL;
+    }
+#endif
+    json_raw_t r = {
+        .js = js,
+        .len = len,
+        .paths = paths,
+        .toks = toks,
+        .pending = (num_paths == 32) ? UINT32_MAX : (1u << num_paths) - 1,
+    };
+    for (int i = 0; i < num_paths; i++) {
+        toks[i].type = JSMN_UNDEFINED;
+    }
+    int pos = json_raw_skip_spaces(js, len, from);
+    if (pos >= len) {
         return -OS_FAIL;
     }
+    for (int i = 0; i < num_paths; i++) {
+        if (paths[i].num_steps == 0) {
+            json_raw_tok(&r, pos, &toks[i]);
+            r.pending &= ~(1u << i);
+        }
+    }
+    if (r.pending && (js[pos] == '{' || js[pos] == '[')) {
+        json_raw_walk(&r, pos, 0, r.pending);
+    }
+    return r.pending ? -OS_FAIL : OS_SUCCESS;
+}
 
-    // Set struct
-    jctx->num_tokens = num_tokens;
-    jctx->tokens = buffer_tokens;
-    jctx->js = js;
+int json_raw_find(const char *js, int len, int from, const json_path_t *path, json_tok_t *tok)
+{
+    return json_raw_find_batch(js, len, from, path, 1, tok);
+}
 
-    // Parse
-    jsmn_init(&jctx->parser);
-    int ret = jsmn_parse(&jctx->parser, js, len, jctx->tokens, jctx->num_tokens);
-    if (ret <= 0) {
-        memset(jctx, 0, sizeof(jparse_ctx_t));
+int json_path_find(jparse_ctx_t *jctx, const json_path_t *path)
+{
+    json_tok_t *elem;
+    if (json_path_find_batch(jctx, path, 1, &elem) != OS_SUCCESS) {
         return -OS_FAIL;
     }
-    jctx->cur = jctx->tokens;
+    jctx->cur = elem;
     return OS_SUCCESS;
 }
 
-int json_parse_end_static(jparse_ctx_t *jctx)
+int json_arr_iter_begin(jparse_ctx_t *jctx, json_iter_t *iter)
 {
-    memset(jctx, 0, sizeof(jparse_ctx_t));
+    json_tok_t *tok = jctx->cur;
+    if (tok->type != JSMN_ARRAY) {
+        return -OS_FAIL;
+    }
+    memset(iter, 0, sizeof(json_iter_t));
+    iter->container = tok - jctx->tokens;
+    iter->next = iter->container + 1;
+    iter->remaining = tok->size;
+    iter->index = -1;
+    return OS_SUCCESS;
+}
+
+int json_arr_iter_next(jparse_ctx_t *jctx, json_iter_t *iter)
+{
+    if (iter->remaining <= 0) {
+        jctx->cur = &jctx->tokens[iter->container];
+        return -OS_FAIL;
+    }
+    jctx->cur = &jctx->tokens[iter->next];
+    iter->next = jctx->cur->next;
+    iter->remaining--;
+    iter->index++;
+    return OS_SUCCESS;
+}
+
+int json_obj_iter_begin(jparse_ctx_t *jctx, json_iter_t *iter)
+{
+    json_tok_t *tok = jctx->cur;
+    if (tok->type != JSMN_OBJECT) {
+        return -OS_FAIL;
+    }
+    memset(iter, 0, sizeof(json_iter_t));
+    iter->container = tok - jctx->tokens;
+    iter->next = iter->container + 1;
+    iter->remaining = tok->size;
+    iter->index = -1;
+    return OS_SUCCESS;
+}
+
+int json_obj_iter_next(jparse_ctx_t *jctx, json_iter_t *iter)
+{
+    if (iter->remaining <= 0) {
+        jctx->cur = &jctx->tokens[iter->container];
+        iter->key = NULL;
+        iter->key_len = 0;
+        return -OS_FAIL;
+    }
+    json_tok_t *key = &jctx->tokens[iter->next];
+    iter->key = jctx->js + key->start;
+    iter->key_len = key->end - key->start;
+    /* The cursor goes to the value, the key's subtree includes it */
+    jctx->cur = key + 1;
+    iter->next = key->next;
+    iter->remaining--;
+    iter->index++;
     return OS_SUCCESS;
 }
 
+int json_cur_get_bool(jparse_ctx_t *jctx, bool *val)
+{
+    if (jctx->cur->type != JSMN_PRIMITIVE) {
+        return -OS_FAIL;
+    }
+    return json_tok_to_bool(jctx, jctx->cur, val);
+}
+
+int json_cur_get_int(jparse_ctx_t *jctx, int *val)
+{
+    if (jctx->cur->type != JSMN_PRIMITIVE) {
+        return -OS_FAIL;
+    }
+    return json_tok_to_int(jctx, jctx->cur, val);
+}
+
+int json_cur_get_int64(jparse_ctx_t *jctx, int64_t *val)
+{
+    if (jctx->cur->type != JSMN_PRIMITIVE) {
+        return -OS_FAIL;
+    }
+    return json_tok_to_int64(jctx, jctx->cur, val);
+}
+
+int json_cur_get_float(jparse_ctx_t *jctx, float *val)
+{
+    if (jctx->cur->type != JSMN_PRIMITIVE) {
+        return -OS_FAIL;
+    }
+    return json_tok_to_float(jctx, jctx->cur, val);
+}
+
+int json_cur_get_string(jparse_ctx_t *jctx, char *val, int size)
+{
+    if (jctx->cur->type != JSMN_STRING) {
+        return -OS_FAIL;
+    }
+    return json_tok_to_string(jctx, jctx->cur, val, size);
+}
+
+int json_cur_get_strview(jparse_ctx_t *jctx, json_str_t *val)
+{
+    if (jctx->cur->type != JSMN_STRING) {
+        return -OS_FAIL;
+    }
+    json_tok_to_strview(jctx, jctx->cur, val);
+    return OS_SUCCESS;
+}
+
+int json_cur_get_strlen(jparse_ctx_t *jctx, int *strlen)
+{
+    if (jctx->cur->type != JSMN_STRING) {
+        return -OS_FAIL;
+    }
+    *strlen = jctx->cur->end - jctx->cur->start;
+    return OS_SUCCESS;
+}
+
+int json_parse_start(jparse_ctx_t *jctx, const char *js, int len)
+{
+    memset(jctx, 0, sizeof(jparse_ctx_t));
+    jsmn_init(&jctx->parser);
+    int num_tokens = jsmn_parse(&jctx->parser, js, len, NULL, 0);
+    if (num_tokens <= 0) {
+        return -OS_FAIL;
+    }
+    jctx->num_tokens = num_tokens;
+    jctx->tokens = calloc(num_tokens, sizeof(json_tok_t));
+    if (!jctx->tokens) {
+        return -OS_FAIL;
+    }
+    jctx->js = js;
+    jsmn_init(&jctx->parser);
+    int ret = jsmn_parse(&jctx->parser, js, len, jctx->tokens, jctx->num_tokens);
+    if (ret <= 0) {
+        free(jctx->tokens);
+        memset(jctx, 0, sizeof(jparse_ctx_t));
+        return -OS_FAIL;
+    }
+    jctx->cur = jctx->tokens;
+    return OS_SUCCESS;
+}
+
+int json_parse_end(jparse_ctx_t *jctx)
+{
+    if (jctx->tokens) {
+        free(jctx->tokens);
+    }
+    memset(jctx, 0, sizeof(jparse_ctx_t));
+    return OS_SUCCESS;
+}
+
+int json_parse_start_static(jparse_ctx_t *jctx, const char *js, int len, json_tok_t *buffer_tokens, int buffer_tokens_max_count)
+{
+    // Init
+    memset(buffer_tokens, 0, buffer_tokens_max_count * sizeof(json_tok_t));
+    memset(jctx, 0, sizeof(jparse_ctx_t));
+
+    // Check fit
+    jsmn_init(&jctx->parser);
+    int num_tokens = jsmn_parse(&jctx->parser, js, len, NULL, 0);
+    if (num_tokens <= 0 || num_tokens > buffer_tokens_max_count) {
+        return -OS_FAIL;
+    }
+
+    // Set struct
+    jctx->num_tokens = num_tokens;
+    jctx->tokens = buffer_tokens;
+    jctx->js = js;
+
+    // Parse
+    jsmn_init(&jctx->parser);
+    int ret = jsmn_parse(&jctx->parser, js, len, jctx->tokens, jctx->num_tokens);
+    if (ret <= 0) {
+        memset(jctx, 0, sizeof(jparse_ctx_t));
+        return -OS_FAIL;
+    }
+    jctx->cur = jctx->tokens;
+    return OS_SUCCESS;
+}
+
+int json_parse_end_static(jparse_ctx_t *jctx)
+{
+    memset(jctx, 0, sizeof(jparse_ctx_t));
+    return OS_SUCCESS;
+}
+
+enum {
+    JSON_TOK_BORROWED,  /* provided by the caller */
+    JSON_TOK_ARENA,
+    JSON_TOK_HEAP,
+};
+
+int json_tok_arena_init(json_tok_arena_t *arena, json_tok_t *tokens, int size)
+{
+    if (!tokens || size <= 0) {
+        return -OS_FAIL;
+    }
+    arena->tokens = tokens;
+    arena->size = size;
+    arena->used = 0;
+    return OS_SUCCESS;
+}
+
+int json_tok_arena_reset(json_tok_arena_t *arena)
+{
+    arena->used = 0;
+    return OS_SUCCESS;
+}
+
+/* Tokenize all of js with exactly num_tokens tokens, taken from the arena if
+ * they fit there */
+static int json_parse_arena_tokens(jparse_ctx_t *jctx, const char *js, int len, int num_tokens)
+{
+    json_tok_arena_t *arena = jctx->arena;
+    if (arena->size - arena->used >= num_tokens) {
+        jctx->tokens = arena->tokens + arena->used;
+        jctx->tok_owner = JSON_TOK_ARENA;
+    } else {
+        jctx->tokens = malloc(num_tokens * sizeof(json_tok_t));
+        if (!jctx->tokens) {
+            return -OS_FAIL;
+        }
+        jctx->tok_owner = JSON_TOK_HEAP;
+    }
+    jctx->num_tokens = num_tokens;
+    jctx->js = js;
+    jsmn_init(&jctx->parser);
+    if (jsmn_parse(&jctx->parser, js, len, jctx->tokens, num_tokens) <= 0) {
+        json_parse_end_arena(jctx);
+        return -OS_FAIL;
+    }
+    if (jctx->tok_owner == JSON_TOK_ARENA) {
+        arena->used += num_tokens;
+    }
+    jctx->cur = jctx->tokens;
+    return OS_SUCCESS;
+}
+
+int json_parse_start_arena(jparse_ctx_t *jctx, const char *js, int len, json_tok_arena_t *arena)
+{
+    memset(jctx, 0, sizeof(jparse_ctx_t));
+    if (!arena) {
+        return -OS_FAIL;
+    }
+    jsmn_init(&jctx->parser);
+    int num_tokens = jsmn_parse(&jctx->parser, js, len, NULL, 0);
+    if (num_tokens <= 0) {
+        return -OS_FAIL;
+    }
+    jctx->arena = arena;
+    return json_parse_arena_tokens(jctx, js, len, num_tokens);
+}
+
+int json_parse_end_arena(jparse_ctx_t *jctx)
+{
+    json_tok_arena_t *arena = jctx->arena;
+    if (jctx->tok_owner == JSON_TOK_HEAP) {
+        free(jctx->tokens);
+    } else if (jctx->tok_owner == JSON_TOK_ARENA &&
+               jctx->tokens + jctx->num_tokens == arena->tokens + arena->used) {
+        arena->used -= jctx->num_tokens;
+    }
+    memset(jctx, 0, sizeof(jparse_ctx_t));
+    return OS_SUCCESS;
+}
+
+
+int json_str_unescape(char *str, int len)
+{
+    return json_unescape(str, len, str, len);
+}
+
+int json_parse_unescape(jparse_ctx_t *jctx)
+{
+    if (!jctx->tokens) {
+        return -OS_FAIL;
+    }
+    if (jctx->unescaped) {
+        return OS_SUCCESS;
+    }
+    for (unsigned int i = 0; i < jctx->parser.toknext; i++) {
+        json_tok_t *tok = &jctx->tokens[i];
+        char *str = (char *) jctx->js + tok->start;
+        int len = tok->end - tok->start;
+        if (tok->type != JSMN_STRING || !memchr(str, '\\', len)) {
+            continue;
+        }
+        len = json_unescape(str, len, str, len);
+        if (len < 0) {
+            return -OS_FAIL;
+        }
+        tok->end = tok->start + len;
+    }
+    jctx->unescaped = true;
+    /* Keys may have changed, the index is rebuilt on the next lookup */
+    if (jctx->key_index) {
+        for (int i = 0; i < JSON_KEY_INDEX_OBJECTS; i++) {
+            jctx->key_index->obj[i] = -1;
+        }
+    }
+    return OS_SUCCESS;
+}
+
+int json_parse_set_key_index(jparse_ctx_t *jctx, json_key_index_t *index)
+{
+    if (index && jctx->num_tokens > UINT16_MAX) {
+        return -OS_FAIL;
+    }
+    if (index) {
+        memset(index, 0, sizeof(json_key_index_t));
+        for (int i = 0; i < JSON_KEY_INDEX_OBJECTS; i++) {
+            index->obj[i] = -1;
+        }
+    }
+    jctx->key_index = index;
+    return OS_SUCCESS;
+}
+
+int json_parse_stream_begin(jparse_ctx_t *jctx, char *buf, int buf_size, json_tok_t *buffer_tokens, int buffer_tokens_max_count)
+{
+    if (!buf || buf_size <= 0 || (buffer_tokens && buffer_tokens_max_count <= 0)) {
+        return -OS_FAIL;
+    }
+    memset(jctx, 0, sizeof(jparse_ctx_t));
+    jsmn_init(&jctx->parser);
+
+    // Tokens are allocated by jsmn as the data arrives
+    jctx->tokens = buffer_tokens;
+    jctx->num_tokens = buffer_tokens_max_count;
+    jctx->js = buf;
+
+    jctx->stream.buf = buf;
+    jctx->stream.size = buf_size;
+    jctx->stream.str_len = -1;
+    jctx->stream.status = JSMN_ERROR_PART;
+    buf[0] = 0;
+    return OS_SUCCESS;
+}
+
+int json_parse_stream_begin_arena(jparse_ctx_t *jctx, char *buf, int buf_size, json_tok_arena_t *arena)
+{
+    if (!arena) {
+        return -OS_FAIL;
+    }
+    int available = arena->size - arena->used;
+    json_tok_t *tokens = (available > 0) ? arena->tokens + arena->used : NULL;
+    if (json_parse_stream_begin(jctx, buf, buf_size, tokens, available) != OS_SUCCESS) {
+        return -OS_FAIL;
+    }
+    // Nothing is taken from the arena until the stream is finished
+    jctx->arena = arena;
+    return OS_SUCCESS;
+}
+
+int json_parse_stream_set_max_strlen(jparse_ctx_t *jctx, int max_strlen)
+{
+    if (max_strlen < 0) {
+        return -OS_FAIL;
+    }
+    jctx->stream.max_strlen = max_strlen;
+    return OS_SUCCESS;
+}
+
+int json_parse_stream_set_sax(jparse_ctx_t *jctx, json_sax_t *sax)
+{
+    if (jctx->tokens || jctx->stream.len) {
+        return -OS_FAIL;
+    }
+    jctx->sax = sax;
+    return OS_SUCCESS;
+}
+
+/* Escape state after a backslash, before knowing if it is a \uXXXX sequence */
+#define STREAM_ESCAPE_START 5
+
+int json_parse_stream_feed(jparse_ctx_t *jctx, const char *data, int len)
+{
+    json_stream_t *stream = &jctx->stream;
+    if (!stream->buf || (stream->status < 0 && stream->status != JSMN_ERROR_PART)) {
+        return -OS_FAIL;
+    }
+    for (int i = 0; i < len; i++) {
+        char c = data[i];
+        if (stream->str_len < 0) {
+            /* Outside strings whitespace carries no information */
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+                continue;
+            }
+            if (c == '\"') {
+                /* Only member values are cut, keys must stay intact */
+                stream->str_len = 0;
+                stream->skippable = (stream->len > 0 && stream->buf[stream->len - 1] == ':');
+            }
+        } else {
+            /* A string may only be cut where a new character starts, never
+             * inside an escape sequence nor inside a multi-byte UTF-8 char */
+            bool boundary = !stream->escape && (((unsigned char) c & 0xC0) != 0x80);
+            if (stream->escape == STREAM_ESCAPE_START) {
+                stream->escape = (c == 'u') ? 4 : 0;
+            } else if (stream->escape) {
+                stream->escape--;
+            } else if (c == '\\') {
+                stream->escape = STREAM_ESCAPE_START;
+            } else if (c == '\"') {
+                stream->str_len = -1;
+                stream->skipping = false;
+            }
+            if (stream->str_len >= 0) {
+                if (!stream->skipping && stream->skippable && boundary && stream->max_strlen &&
+                        stream->str_len >= stream->max_strlen) {
+                    stream->skipping = true;
+                }
+                if (stream->skipping) {
+                    continue;
+                }
+                stream->str_len++;
+            }
+        }
+        if (stream->len >= stream->size - 1) {
+            stream->buf[stream->len] = 0;
+            stream->status = JSMN_ERROR_NOMEM;
+            return -OS_FAIL;
+        }
+        stream->buf[stream->len++] = c;
+    }
+    stream->buf[stream->len] = 0;
+
+    if (!jctx->tokens) {
+        if (jctx->sax && json_sax_feed(jctx->sax, stream->buf, stream->len) != OS_SUCCESS) {
+            stream->status = JSMN_ERROR_INVAL;
+            return -OS_FAIL;
+        }
+        return OS_SUCCESS;
+    }
+
+    // Tokenize what arrived so far, jsmn resumes from its last position
+    stream->status = jsmn_parse(&jctx->parser, stream->buf, stream->len, jctx->tokens, jctx->num_tokens);
+    if (stream->status == JSMN_ERROR_NOMEM && jctx->arena) {
+        // Out of arena tokens, keep collecting and tokenize once it's complete
+        jctx->tokens = NULL;
+        jctx->num_tokens = 0;
+        stream->status = JSMN_ERROR_PART;
+    }
+    if (stream->status < 0 && stream->status != JSMN_ERROR_PART) {
+        return -OS_FAIL;
+    }
+    return OS_SUCCESS;
+}
+
+int json_parse_stream_finish(jparse_ctx_t *jctx)
+{
+    if (jctx->stream.buf && jctx->arena) {
+        if (jctx->tok_owner != JSON_TOK_BORROWED) {
+            return -OS_FAIL;
+        }
+        if (!jctx->tokens) {
+            jsmn_init(&jctx->parser);
+            int num_tokens = jsmn_parse(&jctx->parser, jctx->stream.buf, jctx->stream.len, NULL, 0);
+            if (num_tokens <= 0) {
+                return -OS_FAIL;
+            }
+            return json_parse_arena_tokens(jctx, jctx->stream.buf, jctx->stream.len, num_tokens);
+        }
+        if (jctx->stream.status <= 0) {
+            return -OS_FAIL;
+        }
+        jctx->num_tokens = jctx->parser.toknext;
+        jctx->arena->used += jctx->num_tokens;
+        jctx->tok_owner = JSON_TOK_ARENA;
+        jctx->cur = jctx->tokens;
+        return OS_SUCCESS;
+    }
+    if (jctx->stream.buf && !jctx->tokens) {
+        if (jctx->sax && json_sax_finish(jctx->sax) != OS_SUCCESS) {
+            return -OS_FAIL;
+        }
+        return (jctx->stream.len > 0) ? OS_SUCCESS : -OS_FAIL;
+    }
+    if (!jctx->stream.buf || jctx->stream.status <= 0) {
+        return -OS_FAIL;
+    }
+    jctx->num_tokens = jctx->parser.toknext;
+    jctx->cur = jctx->tokens;
+    return OS_SUCCESS;
+}
+
+enum {
+    SAX_EXPECT_VALUE,
+    SAX_EXPECT_VALUE_OR_END,    /* right after '[' */
+    SAX_EXPECT_KEY,
+    SAX_EXPECT_KEY_OR_END,      /* right after '{' */
+    SAX_EXPECT_COLON,
+    SAX_EXPECT_COMMA_OR_END,
+    SAX_EXPECT_NOTHING,         /* the root element is complete */
+};
+
+static int json_sax_emit(json_sax_t *sax, json_sax_event_t type, int depth, const char *str, int len)
+{
+    if (!sax->cb) {
+        return OS_SUCCESS;
+    }
+    json_sax_evt_t evt = { type, str, len, depth };
+    sax->cur_depth = depth;
+    int ret = sax->cb(sax, &evt, sax->arg);
+    if (ret == JSON_SAX_SKIP && (type == JSON_SAX_OBJECT_START || type == JSON_SAX_ARRAY_START)) {
+        sax->skip = 1;
+    } else if (ret != OS_SUCCESS) {
+        sax->status = JSON_SAX_ERROR_STOPPED;
+        return -OS_FAIL;
+    }
+    return OS_SUCCESS;
+}
+
+static bool json_sax_in_array(json_sax_t *sax)
+{
+    return sax->depth > 0 && (sax->arrays & (1u << (sax->depth - 1)));
+}
+
+/* Elements of an object got their path from the key */
+static void json_sax_value_begin(json_sax_t *sax)
+{
+    if (json_sax_in_array(sax)) {
+        sax->path[sax->depth].key = -1;
+        sax->path[sax->depth].len = 0;
+    }
+}
+
+static void json_sax_value_end(json_sax_t *sax)
+{
+    sax->expect = sax->depth ? SAX_EXPECT_COMMA_OR_END : SAX_EXPECT_NOTHING;
+}
+
+#define SAX_STR_PART  -1 /* the string hasn't all arrived yet */
+#define SAX_STR_INVAL -2 /* it has an escape jsmn rejects */
+
+/* Length of the escape whose backslash is at i, backslash excluded, as jsmn
+ * accepts them: one of "\/bfnrt, or u and 4 hex digits */
+static int json_sax_escape_len(json_sax_t *sax, int i)
+{
+    if (i + 1 >= sax->len) {
+        return SAX_STR_PART;
+    }
+    char c = sax->js[i + 1];
+    if (c && strchr("\"\\/bfnrt", c)) {
+        return 1;
+    }
+    if (c != 'u') {
+        return SAX_STR_INVAL;
+    }
+    uint32_t code;
+    int left = sax->len - i - 2;
+    if (json_hex4(sax->js + i + 2, left, &code) == OS_SUCCESS) {
+        return 5;
+    }
+    /* Digits still to come, or not digits */
+    for (int n = 0; n < left && n < 4; n++) {
+        c = sax->js[i + 2 + n];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))) {
+            return SAX_STR_INVAL;
+        }
+    }
+    return SAX_STR_PART;
+}
+
+/* Length of the string whose opening quote is at pos, or SAX_STR_* */
+static int json_sax_strlen(json_sax_t *sax)
+{
+    for (int i = sax->pos + 1; i < sax->len; i++) {
+#ifdef JSMN_FAST_SCAN
+        i = jsmn_scan_string(sax->js, i, sax->len);
+        if (i == sax->len) {
+            break;
+        }
+#endif
+        if (sax->js[i] == '\\') {
+            int len = json_sax_escape_len(sax, i);
+            if (len < 0) {
+                return len;
+            }
+            i += len;
+        } else if (sax->js[i] == '\"') {
+            return i - sax->pos - 1;
+        }
+    }
+    return SAX_STR_PART;
+}
+
+/* Move to the bracket closing the container being skipped: OS_SUCCESS, or
+ * SAX_STR_PART if it hasn't arrived yet, SAX_STR_INVAL if a string of it is
+ * invalid */
+static int json_sax_skip(json_sax_t *sax)
+{
+    while (sax->pos < sax->len) {
+        char c = sax->js[sax->pos];
+        if (c == '\"') {
+            int len = json_sax_strlen(sax);
+            if (len < 0) {
+                return len;
+            }
+            sax->pos += len + 2;
+            continue;
+        }
+        if (c == '{' || c == '[') {
+            sax->skip++;
+        } else if ((c == '}' || c == ']') && --sax->skip == 0) {
+            sax->expect = SAX_EXPECT_COMMA_OR_END;
+            return OS_SUCCESS;
+        }
+        sax->pos++;
+    }
+    return SAX_STR_PART;
+}
+
+static int json_sax_run(json_sax_t *sax, bool last)
+{
+    const char *js = sax->js;
+    while (sax->pos < sax->len) {
+        if (sax->skip) {
+            int skipped = json_sax_skip(sax);
+            if (skipped == SAX_STR_INVAL) {
+                goto inval;
+            } else if (skipped != OS_SUCCESS) {
+                break;
+            }
+        }
+        char c = js[sax->pos];
+        int depth = sax->depth;
+        bool expect_value = (sax->expect == SAX_EXPECT_VALUE || sax->expect == SAX_EXPECT_VALUE_OR_END);
+        int ret = OS_SUCCESS;
+        switch (c) {
+        case ' ': case '\t': case '\r': case '\n':
+            sax->pos++;
+            break;
+        case '{': case '[':
+            if (!expect_value) {
+                goto inval;
+            }
+            if (depth >= JSON_SAX_MAX_DEPTH) {
+                sax->status = JSON_SAX_ERROR_DEPTH;
+                return -OS_FAIL;
+            }
+            json_sax_value_begin(sax);
+            sax->pos++;
+            sax->depth++;
+            if (c == '{') {
+                sax->arrays &= ~(1u << depth);
+                sax->expect = SAX_EXPECT_KEY_OR_END;
+                ret = json_sax_emit(sax, JSON_SAX_OBJECT_START, depth, NULL, 0);
+            } else {
+                sax->arrays |= 1u << depth;
+                sax->expect = SAX_EXPECT_VALUE_OR_END;
+                ret = json_sax_emit(sax, JSON_SAX_ARRAY_START, depth, NULL, 0);
+            }
+            break;
+        case '}': case ']': {
+            bool is_array = (c == ']');
+            if (depth == 0 || json_sax_in_array(sax) != is_array) {
+                goto inval;
+            }
+            if (sax->expect != SAX_EXPECT_COMMA_OR_END &&
+                    sax->expect != (is_array ? SAX_EXPECT_VALUE_OR_END : SAX_EXPECT_KEY_OR_END)) {
+                goto inval;
+            }
+            sax->pos++;
+            sax->depth--;
+            json_sax_value_end(sax);
+            ret = json_sax_emit(sax, is_array ? JSON_SAX_ARRAY_END : JSON_SAX_OBJECT_END, depth - 1, NULL, 0);
+            break;
+        }
+        case ',':
+            if (sax->expect != SAX_EXPECT_COMMA_OR_END) {
+                goto inval;
+            }
+            sax->pos++;
+            sax->expect = json_sax_in_array(sax) ? SAX_EXPECT_VALUE : SAX_EXPECT_KEY;
+            break;
+        case ':':
+            if (sax->expect != SAX_EXPECT_COLON) {
+                goto inval;
+            }
+            sax->pos++;
+            sax->expect = SAX_EXPECT_VALUE;
+            break;
+        case '\"': {
+            bool is_key = (sax->expect == SAX_EXPECT_KEY || sax->expect == SAX_EXPECT_KEY_OR_END);
+            if (!is_key && !expect_value) {
+                goto inval;
+            }
+            int len = json_sax_strlen(sax);
+            if (len == SAX_STR_INVAL) {
+                goto inval;
+            } else if (len < 0) {
+                sax->status = JSON_SAX_PART;
+                return OS_SUCCESS;
+            }
+            const char *str = js + sax->pos + 1;
+            if (is_key) {
+                sax->path[depth].key = sax->pos + 1;
+                sax->path[depth].len = len;
+                sax->pos += len + 2;
+                sax->expect = SAX_EXPECT_COLON;
+                ret = json_sax_emit(sax, JSON_SAX_KEY, depth, str, len);
+            } else {
+                json_sax_value_begin(sax);
+                sax->pos += len + 2;
+                json_sax_value_end(sax);
+                ret = json_sax_emit(sax, JSON_SAX_STRING, depth, str, len);
+            }
+            break;
+        }
+        default: {
+            if (!expect_value || c == 0 || !strchr("-0123456789tfn", c)) {
+                goto inval;
+            }
+            int end = sax->pos;
+            while (end < sax->len && js[end] && !strchr(",]} \t\r\n", js[end])) {
+                end++;
+            }
+            /* A number could go on in the next chunk */
+            if (end == sax->len && !last) {
+                sax->status = JSON_SAX_PART;
+                return OS_SUCCESS;
+            }
+            const char *str = js + sax->pos;
+            json_sax_value_begin(sax);
+            sax->pos = end;
+            json_sax_value_end(sax);
+            ret = json_sax_emit(sax, JSON_SAX_PRIMITIVE, depth, str, end - (str - js));
+            break;
+        }
+        }
+        if (ret != OS_SUCCESS) {
+            return -OS_FAIL;
+        }
+    }
+    sax->status = (sax->expect == SAX_EXPECT_NOTHING) ? JSON_SAX_DONE : JSON_SAX_PART;
+    return OS_SUCCESS;
+
+inval:
+    sax->status = JSON_SAX_ERROR_INVAL;
+    return -OS_FAIL;
+}
+
+int json_sax_begin(json_sax_t *sax, json_sax_cb_t cb, void *arg)
+{
+    memset(sax, 0, sizeof(json_sax_t));
+    sax->cb = cb;
+    sax->arg = arg;
+    sax->expect = SAX_EXPECT_VALUE;
+    sax->status = JSON_SAX_PART;
+    return OS_SUCCESS;
+}
+
+int json_sax_feed(json_sax_t *sax, const char *js, int len)
+{
+    if ((sax->status != JSON_SAX_PART && sax->status != JSON_SAX_DONE) || len < sax->pos) {
+        return -OS_FAIL;
+    }
+    sax->js = js;
+    sax->len = len;
+    return json_sax_run(sax, false);
+}
+
+int json_sax_finish(json_sax_t *sax)
+{
+    if (sax->status == JSON_SAX_PART && sax->js) {
+        json_sax_run(sax, true);
+    }
+    return (sax->status == JSON_SAX_DONE) ? OS_SUCCESS : -OS_FAIL;
+}
+
+int json_sax_parse(const char *js, int len, json_sax_cb_t cb, void *arg)
+{
+    json_sax_t sax;
+    json_sax_begin(&sax, cb, arg);
+    if (json_sax_feed(&sax, js, len) != OS_SUCCESS) {
+        return -OS_FAIL;
+    }
+    return json_sax_finish(&sax);
+}
+
+bool json_sax_path_match(const json_sax_t *sax, int depth, const char *path)
+{
+    if (!path || depth < 0 || depth > sax->cur_depth) {
+        return false;
+    }
+    for (int d = depth + 1; d <= sax->cur_depth; d++) {
+        if (sax->path[d].key < 0) {
+            if (path[0] != '[' || path[1] != ']') {
+                return false;
+            }
+            path += 2;
+            continue;
+        }
+        if (d > depth + 1) {
+            if (*path != '.') {
+                return false;
+            }
+            path++;
+        }
+        if (strncmp(path, sax->js + sax->path[d].key, sax->path[d].len) != 0) {
+            return false;
+        }
+        path += sax->path[d].len;
+    }
+    return *path == 0;
+}
+
+typedef struct {
+    const char *root;
+    int root_depth;             /* -1 until the root object is found */
+    const json_field_t *fields;
+    uint32_t pending;
+    uint32_t found;
+    void *dest;
+} json_sax_extract_t;
+
+int json_sax_field_store(json_sax_t *sax, const json_sax_evt_t *evt, const json_field_t *field, void *dest)
+{
+    /* A key on the field's path, or the container the field is */
+    if (evt->type != JSON_SAX_STRING && evt->type != JSON_SAX_PRIMITIVE) {
+        return -OS_FAIL;
+    }
+    /* The converters only look at the token's type and bounds */
+    jparse_ctx_t jctx = { .js = sax->js };
+    json_tok_t tok = {
+        .type = (evt->type == JSON_SAX_STRING) ? JSMN_STRING : JSMN_PRIMITIVE,
+        .start = evt->str - sax->js,
+        .end = evt->str - sax->js + evt->len,
+    };
+    return json_field_store(&jctx, &tok, field, dest);
+}
+
+static int json_sax_extract_cb(json_sax_t *sax, const json_sax_evt_t *evt, void *arg)
+{
+    json_sax_extract_t *ext = (json_sax_extract_t *) arg;
+    if (ext->root_depth < 0) {
+        if (evt->type == JSON_SAX_OBJECT_START && json_sax_path_match(sax, 0, ext->root)) {
+            ext->root_depth = evt->depth;
+        }
+        return OS_SUCCESS;
+    }
+    if (evt->type == JSON_SAX_OBJECT_END && evt->depth == ext->root_depth) {
+        return -OS_FAIL;
+    }
+    if (evt->type != JSON_SAX_STRING && evt->type != JSON_SAX_PRIMITIVE) {
+        return OS_SUCCESS;
+    }
+    for (uint32_t pending = ext->pending; pending; pending &= pending - 1) {
+        int i = __builtin_ctz(pending);
+        if (!json_sax_path_match(sax, ext->root_depth, ext->fields[i].path)) {
+            continue;
+        }
+        if (json_sax_field_store(sax, evt, &ext->fields[i], ext->dest) == OS_SUCCESS) {
+            ext->found |= 1u << i;
+        }
+        ext->pending &= ~(1u << i);
+    }
+    /* Nothing left to look for, stop scanning */
+    return ext->pending ? OS_SUCCESS : -OS_FAIL;
+}
+
+int json_sax_extract(const char *js, int len, const char *root, const json_field_t *fields, int num_fields,
+                     void *dest, uint32_t *found)
+{
+    if (num_fields <= 0 || num_fields > JSON_EXTRACT_MAX_FIELDS) {
+        return -OS_FAIL;
+    }
+    uint32_t all = (num_fields == 32) ? UINT32_MAX : (1u << num_fields) - 1;
+    json_sax_extract_t ext = {
+        .root = root ? root : "",
+        .root_depth = -1,
+        .fields = fields,
+        .pending = all,
+        .dest = dest,
+    };
+    json_sax_t sax;
+    json_sax_begin(&sax, json_sax_extract_cb, &ext);
+    if (json_sax_feed(&sax, js, len) == OS_SUCCESS) {
+        json_sax_finish(&sax);
+    }
+    if (found) {
+        *found = ext.found;
+    }
+    /* Stopping early is how a successful extraction usually ends */
+    if (sax.status != JSON_SAX_DONE && sax.status != JSON_SAX_ERROR_STOPPED) {
+        return -OS_FAIL;
+    }
+    return (ext.found == all) ? OS_SUCCESS : -OS_FAIL;
+}
+
+/* State of json_parse_start_query(): SAX events are turned into tokens, only
+ * for the elements on the paths */
+typedef struct {
+    json_tok_t *tokens;
+    int num_tokens;
+    int used;
+    bool nomem;
+    const json_path_t *paths;
+    uint32_t all;
+    uint32_t resolved;          /* paths found, or known to be missing */
+    int keep_depth;             /* a path ends on the container at this depth, -1 if none */
+    uint32_t keep_paths;        /* paths resolved when it ends */
+    bool skipping;              /* the container being scanned is left out */
+    int skipped;                /* its empty token, -1 if it has none */
+    int key;                    /* key token of the member being parsed, -1 if it's left out */
+    uint32_t member;            /* paths through the member being parsed */
+    struct {
+        int tok;
+        uint32_t paths;         /* paths through the container */
+        int index;              /* elements seen so far, for arrays */
+    } open[JSON_SAX_MAX_DEPTH];
+} json_query_t;
+
+static int json_query_tok(json_query_t *q, jsmntype_t type, int start, int end, int parent)
+{
+    if (q->used >= q->num_tokens) {
+        q->nomem = true;
+        return -1;
+    }
+    json_tok_t *tok = &q->tokens[q->used];
+    tok->type = type;
+    tok->start = start;
+    tok->end = end;
+    tok->size = 0;
+    tok->parent = parent;
+    tok->next = q->used + 1;
+    if (parent >= 0) {
+        q->tokens[parent].size++;
+    }
+    return q->used++;
+}
+
+/* The subtree of tok is complete, so is its key's */
+static void json_query_close(json_query_t *q, int tok, int end)
+{
+    q->tokens[tok].end = end;
+    q->tokens[tok].next = q->used;
+    int parent = q->tokens[tok].parent;
+    if (parent >= 0 && q->tokens[parent].type == JSMN_STRING) {
+        q->tokens[parent].next = q->used;
+    }
+}
+
+/* Paths ending on the element at depth, among the ones that lead to it */
+static uint32_t json_query_targets(json_query_t *q, uint32_t paths, int depth)
+{
+    uint32_t targets = 0;
+    for (uint32_t pending = paths; pending; pending &= pending - 1) {
+        int i = __builtin_ctz(pending);
+        if (q->paths[i].num_steps == depth) {
+            targets |= 1u << i;
+        }
+    }
+    return targets;
+}
+
+static int json_query_cb(json_sax_t *sax, const json_sax_evt_t *evt, void *arg)
+{
+    json_query_t *q = (json_query_t *) arg;
+    int depth = evt->depth;
+    bool kept = q->keep_depth >= 0 && depth > q->keep_depth;
+    bool is_container = (evt->type == JSON_SAX_OBJECT_START || evt->type == JSON_SAX_ARRAY_START);
+
+    if (evt->type == JSON_SAX_OBJECT_END || evt->type == JSON_SAX_ARRAY_END) {
+        if (q->skipping) {
+            if (q->skipped >= 0) {
+                json_query_close(q, q->skipped, sax->pos);
+            }
+            q->skipping = false;
+            q->skipped = -1;
+        } else {
+            if (!kept && depth == q->keep_depth) {
+                q->resolved |= q->keep_paths;
+                q->keep_depth = -1;
+            } else if (!kept) {
+                q->resolved |= q->open[depth].paths;
+            }
+            json_query_close(q, q->open[depth].tok, sax->pos);
+        }
+        return (q->resolved == q->all) ? -OS_FAIL : OS_SUCCESS;
+    }
+
+    int parent = -1;
+    uint32_t paths = q->all;
+    bool placeholder = false;
+    if (depth > 0) {
+        uint32_t pending = kept ? 0 : q->open[depth - 1].paths;
+        parent = q->open[depth - 1].tok;
+        paths = 0;
+        if (evt->type == JSON_SAX_KEY) {
+            for (; pending; pending &= pending - 1) {
+                int i = __builtin_ctz(pending);
+                const json_path_step_t *step = &q->paths[i].steps[depth - 1];
+                if (step->key && step->key_len == evt->len && memcmp(step->key, evt->str, evt->len) == 0) {
+                    paths |= 1u << i;
+                }
+            }
+            q->member = paths;
+            q->key = -1;
+            if (kept || paths) {
+                int start = evt->str - sax->js;
+                q->key = json_query_tok(q, JSMN_STRING, start, start + evt->len, parent);
+            }
+            return q->nomem ? -OS_FAIL : OS_SUCCESS;
+        }
+        if (sax->arrays & (1u << (depth - 1))) {
+            int index = q->open[depth - 1].index++;
+            for (; pending; pending &= pending - 1) {
+                int i = __builtin_ctz(pending);
+                const json_path_step_t *step = &q->paths[i].steps[depth - 1];
+                if (!step->key && step->index == index) {
+                    paths |= 1u << i;
+                } else if (!step->key && step->index > index) {
+                    /* An empty token keeps the index of the next elements */
+                    placeholder = true;
+                }
+            }
+        } else {
+            paths = q->member;
+            parent = q->key;
+        }
+    }
+
+    uint32_t targets = kept ? 0 : json_query_targets(q, paths, depth);
+    bool needed = kept || targets || (paths && is_container);
+    if (!needed) {
+        /* Paths going on into a scalar can't be found */
+        q->resolved |= paths;
+        if (!placeholder && is_container) {
+            q->skipping = true;
+            return JSON_SAX_SKIP;
+        } else if (!placeholder) {
+            return (q->resolved == q->all) ? -OS_FAIL : OS_SUCCESS;
+        }
+    }
+
+    if (is_container) {
+        jsmntype_t type = (evt->type == JSON_SAX_OBJECT_START) ? JSMN_OBJECT : JSMN_ARRAY;
+        int tok = json_query_tok(q, type, sax->pos - 1, JSMN_POS_UNSET, parent);
+        if (tok < 0) {
+            return -OS_FAIL;
+        }
+        if (!needed) {
+            q->skipping = true;
+            q->skipped = tok;
+            return JSON_SAX_SKIP;
+        }
+        q->open[depth].tok = tok;
+        q->open[depth].paths = paths;
+        q->open[depth].index = 0;
+        if (targets) {
+            q->keep_depth = depth;
+            q->keep_paths = paths;
+        }
+        return OS_SUCCESS;
+    }
+
+    int start = evt->str - sax->js;
+    int tok = json_query_tok(q, (evt->type == JSON_SAX_STRING) ? JSMN_STRING : JSMN_PRIMITIVE,
+                             start, start + evt->len, parent);
+    if (tok < 0) {
+        return -OS_FAIL;
+    }
+    json_query_close(q, tok, start + evt->len);
+    q->resolved |= paths;
+    return (q->resolved == q->all) ? -OS_FAIL : OS_SUCCESS;
+}
+
+int json_parse_start_query(jparse_ctx_t *jctx, const char *js, int len, json_tok_arena_t *arena,
+                           const json_path_t *paths, int num_paths)
+{
+    memset(jctx, 0, sizeof(jparse_ctx_t));
+    if (!arena || num_paths <= 0 || num_paths > JSON_QUERY_MAX_PATHS) {
+        return -OS_FAIL;
+    }
+#ifdef JSMN_COMPACT_TOKENS
+    if (len >= JSMN_POS_UNSET) {
+        return -OS_FAIL;
+    }
+#endif
+    json_query_t q = {
+        .tokens = arena->tokens + arena->used,
+        .num_tokens = arena->size - arena->used,
+        .paths = paths,
+        .all = (num_paths == 32) ? UINT32_MAX : (1u << num_paths) - 1,
+        .keep_depth = -1,
+        .skipped = -1,
+        .key = -1,
+    };
+#ifdef JSMN_MAX_TOKENS
+    if (q.num_tokens > JSMN_MAX_TOKENS) {
+        q.num_tokens = JSMN_MAX_TOKENS;
+    }
+#endif
+    json_sax_t sax;
+    json_sax_begin(&sax, json_query_cb, &q);
+    if (json_sax_feed(&sax, js, len) == OS_SUCCESS) {
+        json_sax_finish(&sax);
+    }
+    if (q.nomem) {
+        return json_parse_start_arena(jctx, js, len, arena);
+    }
+    if ((sax.status != JSON_SAX_DONE && sax.status != JSON_SAX_ERROR_STOPPED) || q.used == 0) {
+        return -OS_FAIL;
+    }
+
+    /* Containers still open when the scan stopped end there */
+    for (int i = q.used - 1; i >= 0; i--) {
+        if (q.tokens[i].end == JSMN_POS_UNSET) {
+            json_query_close(&q, i, sax.pos);
+        }
+    }
+    jctx->js = js;
+    jctx->tokens = q.tokens;
+    jctx->num_tokens = q.used;
+    jctx->parser.toknext = q.used;
+    jctx->arena = arena;
+    jctx->tok_owner = JSON_TOK_ARENA;
+    arena->used += q.used;
+    jctx->cur = jctx->tokens;
+    return OS_SUCCESS;
+}
+
+static void json_gen_flush(json_gen_str_t *jstr)
+{
+    if (jstr->used && jstr->err == OS_SUCCESS && jstr->flush_cb(jstr->buf, jstr->used, jstr->priv) != OS_SUCCESS) {
+        jstr->err = -OS_FAIL;
+    }
+    jstr->used = 0;
+}
+
+static void json_gen_add(json_gen_str_t *jstr, const char *str, int len)
+{
+    jstr->len += len;
+    if (!jstr->flush_cb) {
+        return;
+    }
+    while (len > 0) {
+        int n = jstr->buf_size - jstr->used;
+        n = (len < n) ? len : n;
+        memcpy(jstr->buf + jstr->used, str, n);
+        jstr->used += n;
+        str += n;
+        len -= n;
+        if (jstr->used == jstr->buf_size) {
+            json_gen_flush(jstr);
+        }
+    }
+}
+
+static void json_gen_add_string(json_gen_str_t *jstr, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    json_gen_add(jstr, "\"", 1);
+    while (*str) {
+        /* Runs of plain characters are copied at once */
+        int n = 0;
+        while (str[n] && str[n] != '\"' && str[n] != '\\' && (unsigned char) str[n] >= 0x20) {
+            n++;
+        }
+        json_gen_add(jstr, str, n);
+        str += n;
+        if (!*str) {
+            break;
+        }
+        char esc[6] = { '\\', *str };
+        int len = 2;
+        switch (*str) {
+        case '\"':
+        case '\\':
+            break;
+        case '\b': esc[1] = 'b'; break;
+        case '\f': esc[1] = 'f'; break;
+        case '\n': esc[1] = 'n'; break;
+        case '\r': esc[1] = 'r'; break;
+        case '\t': esc[1] = 't'; break;
+        default:
+            memcpy(esc + 1, "u00", 3);
+            esc[4] = hex[*str >> 4];
+            esc[5] = hex[*str & 0xf];
+            len = 6;
+            break;
+        }
+        json_gen_add(jstr, esc, len);
+        str++;
+    }
+    json_gen_add(jstr, "\"", 1);
+}
+
+/* Separator and name of the element that follows */
+static void json_gen_add_name(json_gen_str_t *jstr, const char *name)
+{
+    if (jstr->comma_req) {
+        json_gen_add(jstr, ",", 1);
+    }
+    if (name) {
+        json_gen_add_string(jstr, name);
+        json_gen_add(jstr, ":", 1);
+    }
+}
+
+static int json_gen_open(json_gen_str_t *jstr, const char *name, const char *bracket)
+{
+    json_gen_add_name(jstr, name);
+    json_gen_add(jstr, bracket, 1);
+    jstr->comma_req = false;
+    return jstr->err;
+}
+
+static int json_gen_close(json_gen_str_t *jstr, const char *bracket)
+{
+    json_gen_add(jstr, bracket, 1);
+    jstr->comma_req = true;
+    return jstr->err;
+}
+
+static int json_gen_set_raw(json_gen_str_t *jstr, const char *name, const char *val, int len)
+{
+    json_gen_add_name(jstr, name);
+    json_gen_add(jstr, val, len);
+    jstr->comma_req = true;
+    return jstr->err;
+}
+
+static int json_gen_set_int(json_gen_str_t *jstr, const char *name, int64_t val)
+{
+    char str[24];
+    int len = snprintf(str, sizeof(str), "%" PRId64, val);
+    return json_gen_set_raw(jstr, name, str, len);
+}
+
+static int json_gen_set_string(json_gen_str_t *jstr, const char *name, const char *val)
+{
+    if (!val) {
+        return json_gen_set_raw(jstr, name, "null", 4);
+    }
+    json_gen_add_name(jstr, name);
+    json_gen_add_string(jstr, val);
+    jstr->comma_req = true;
+    return jstr->err;
+}
+
+void json_gen_str_start(json_gen_str_t *jstr, char *buf, int buf_size, json_gen_flush_cb_t flush_cb, void *priv)
+{
+    memset(jstr, 0, sizeof(json_gen_str_t));
+    jstr->buf = buf;
+    jstr->buf_size = buf_size;
+    jstr->flush_cb = (buf && buf_size > 0) ? flush_cb : NULL;
+    jstr->priv = priv;
+}
+
+int json_gen_str_end(json_gen_str_t *jstr)
+{
+    if (jstr->flush_cb) {
+        json_gen_flush(jstr);
+    }
+    return jstr->err;
+}
+
+int json_gen_start_object(json_gen_str_t *jstr)
+{
+    return json_gen_open(jstr, NULL, "{");
+}
+
+int json_gen_end_object(json_gen_str_t *jstr)
+{
+    return json_gen_close(jstr, "}");
+}
+
+int json_gen_start_array(json_gen_str_t *jstr)
+{
+    return json_gen_open(jstr, NULL, "[");
+}
+
+int json_gen_end_array(json_gen_str_t *jstr)
+{
+    return json_gen_close(jstr, "]");
+}
+
+int json_gen_push_object(json_gen_str_t *jstr, const char *name)
+{
+    return json_gen_open(jstr, name, "{");
+}
+
+int json_gen_pop_object(json_gen_str_t *jstr)
+{
+    return json_gen_close(jstr, "}");
+}
+
+int json_gen_push_array(json_gen_str_t *jstr, const char *name)
+{
+    return json_gen_open(jstr, name, "[");
+}
+
+int json_gen_pop_array(json_gen_str_t *jstr)
+{
+    return json_gen_close(jstr, "]");
+}
+
+int json_gen_obj_set_bool(json_gen_str_t *jstr, const char *name, bool val)
+{
+    return json_gen_set_raw(jstr, name, val ? "true" : "false", val ? 4 : 5);
+}
+
+int json_gen_obj_set_int(json_gen_str_t *jstr, const char *name, int64_t val)
+{
+    return json_gen_set_int(jstr, name, val);
+}
+
+int json_gen_obj_set_string(json_gen_str_t *jstr, const char *name, const char *val)
+{
+    return json_gen_set_string(jstr, name, val);
+}
+
+int json_gen_obj_set_null(json_gen_str_t *jstr, const char *name)
+{
+    return json_gen_set_raw(jstr, name, "null", 4);
+}
+
+int json_gen_arr_set_bool(json_gen_str_t *jstr, bool val)
+{
+    return json_gen_obj_set_bool(jstr, NULL, val);
+}
+
+int json_gen_arr_set_int(json_gen_str_t *jstr, int64_t val)
+{
+    return json_gen_set_int(jstr, NULL, val);
+}
+
+int json_gen_arr_set_string(json_gen_str_t *jstr, const char *val)
+{
+    return json_gen_set_string(jstr, NULL, val);
+}
+
+int json_gen_arr_set_null(json_gen_str_t *jstr)
+{
+    return json_gen_set_raw(jstr, NULL, "null", 4);
+}
@@ -1,8 +1,13 @@
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "json_parser.h"
 #include "unity.h"
 
+/* Captured /me/player response */
+extern const char player_state_json_start[] asm("_binary_player_state_json_start");
+
 #define json_test_str   "{\n\"str_val\" :    \"JSON Parser\",\n" \
             "\t\"float_val\" : 2.0,\n" \
             "\"int_val\" : 2017,\n" \
@@ -67,4 +72,925 @@ TEST_CASE("json_parser basic tests", "[json_parser]")
     TEST_ASSERT(int64_val == 109174583252);
 
     json_parse_end(&jctx);
-}
\ No newline at end of file
+}
+TEST_CASE("json_parser stream tests", "[json_parser]")
+{
+    jparse_ctx_t jctx;
+    json_tok_t tokens[32];
+    char buf[256];
+    const char *js = json_test_str;
+    int len = strlen(js);
+
+    /* Feed a few bytes at a time, as an HTTP client would */
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_begin(&jctx, buf, sizeof(buf), tokens, 32));
+    for (int i = 0; i < len; i += 3) {
+        int chunk = (len - i) < 3 ? (len - i) : 3;
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_feed(&jctx, js + i, chunk));
+    }
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_finish(&jctx));
+
+    char str_val[64];
+    int int_val, num_elem;
+    int64_t int64_val;
+    bool bool_val;
+
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "str_val", str_val, sizeof(str_val)));
+    TEST_ASSERT_EQUAL_STRING("JSON Parser", str_val);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_int(&jctx, "int_val", &int_val));
+    TEST_ASSERT_EQUAL_INT(2017, int_val);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_array(&jctx, "supported_el", &num_elem));
+    TEST_ASSERT_EQUAL(6, num_elem);
+    json_obj_leave_array(&jctx);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_object(&jctx, "features"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_bool(&jctx, "objects", &bool_val));
+    TEST_ASSERT_EQUAL(true, bool_val);
+    json_obj_leave_object(&jctx);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_int64(&jctx, "int_64", &int64_val));
+    TEST_ASSERT(int64_val == 109174583252);
+    json_parse_end_static(&jctx);
+
+    /* Long strings are cut on a character boundary, escapes are kept whole */
+    const char *long_js = "{\"description\": \"abc\\u00e9\\\"\xc3\xa9xyz\", \"id\": \"42\"}";
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_begin(&jctx, buf, sizeof(buf), tokens, 32));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_set_max_strlen(&jctx, 4));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_feed(&jctx, long_js, strlen(long_js)));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_finish(&jctx));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "description", str_val, sizeof(str_val)));
+    TEST_ASSERT_EQUAL_STRING("abc\xc3\xa9", str_val);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "id", str_val, sizeof(str_val)));
+    TEST_ASSERT_EQUAL_STRING("42", str_val);
+    json_parse_end_static(&jctx);
+
+    /* Incomplete data or a too small buffer must not report success */
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_begin(&jctx, buf, sizeof(buf), tokens, 32));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_feed(&jctx, js, len / 2));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_parse_stream_finish(&jctx));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_begin(&jctx, buf, 16, tokens, 32));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_parse_stream_feed(&jctx, js, len));
+    json_parse_end_static(&jctx);
+}
+
+#define json_iter_str "{\"devices\":[{\"id\":\"a\",\"tags\":[1,[2,3]],\"name\":\"one\"}," \
+            "{\"id\":\"b\",\"tags\":{\"x\":{\"y\":[]}},\"name\":\"two\"}," \
+            "{\"id\":\"c\",\"name\":\"three\"}],\"count\":3}"
+
+TEST_CASE("json_parser iterator tests", "[json_parser]")
+{
+    jparse_ctx_t jctx;
+    json_iter_t it;
+    char str_val[16];
+    int num_elem, int_val;
+    const char *names[] = {"one", "two", "three"};
+
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start(&jctx, json_iter_str, strlen(json_iter_str)));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_array(&jctx, "devices", &num_elem));
+    TEST_ASSERT_EQUAL(3, num_elem);
+
+    /* Indexed access skips whole subtrees */
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_arr_get_object(&jctx, 2));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "id", str_val, sizeof(str_val)));
+    TEST_ASSERT_EQUAL_STRING("c", str_val);
+    json_arr_leave_object(&jctx);
+
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_arr_iter_begin(&jctx, &it));
+    while (json_arr_iter_next(&jctx, &it) == OS_SUCCESS) {
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "name", str_val, sizeof(str_val)));
+        TEST_ASSERT_EQUAL_STRING(names[it.index], str_val);
+    }
+    TEST_ASSERT_EQUAL(2, it.index);
+    json_obj_leave_array(&jctx);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_int(&jctx, "count", &int_val));
+    TEST_ASSERT_EQUAL_INT(3, int_val);
+
+    /* Members of an object, the cursor is on each value */
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_iter_begin(&jctx, &it));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_iter_next(&jctx, &it));
+    TEST_ASSERT_EQUAL_STRING_LEN("devices", it.key, it.key_len);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_iter_next(&jctx, &it));
+    TEST_ASSERT_EQUAL_STRING_LEN("count", it.key, it.key_len);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_int(&jctx, &int_val));
+    TEST_ASSERT_EQUAL_INT(3, int_val);
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_obj_iter_next(&jctx, &it));
+    TEST_ASSERT(jctx.cur == jctx.tokens);
+
+    json_parse_end(&jctx);
+}
+
+/* The lookups parse_track() does on a player state of a new track */
+static int player_state_lookups(jparse_ctx_t *jctx, char *name, int size)
+{
+    int64_t int64_val;
+    bool bool_val;
+    int num_elem, int_val;
+    json_iter_t it;
+    int ret = OS_SUCCESS;
+
+    ret |= json_obj_get_object(jctx, "item");
+    ret |= json_obj_get_string(jctx, "id", name, size);
+    ret |= json_obj_get_string(jctx, "name", name, size);
+    ret |= json_obj_get_int64(jctx, "duration_ms", &int64_val);
+    ret |= json_obj_get_array(jctx, "artists", &num_elem);
+    ret |= json_arr_iter_begin(jctx, &it);
+    while (json_arr_iter_next(jctx, &it) == OS_SUCCESS) {
+        ret |= json_obj_get_string(jctx, "name", name, size);
+    }
+    ret |= json_obj_leave_array(jctx);
+    ret |= json_obj_get_object(jctx, "album");
+    ret |= json_obj_get_string(jctx, "name", name, size);
+    ret |= json_obj_get_array(jctx, "images", &num_elem);
+    ret |= json_arr_get_object(jctx, 1);
+    ret |= json_obj_get_int(jctx, "height", &int_val);
+    ret |= json_obj_get_string(jctx, "url", name, size);
+    ret |= json_arr_leave_object(jctx);
+    ret |= json_obj_leave_array(jctx);
+    ret |= json_obj_leave_object(jctx);
+    ret |= json_obj_leave_object(jctx);
+    ret |= json_obj_get_int64(jctx, "progress_ms", &int64_val);
+    ret |= json_obj_get_bool(jctx, "is_playing", &bool_val);
+    return ret;
+}
+
+TEST_CASE("json_parser key index tests", "[json_parser]")
+{
+    jparse_ctx_t jctx;
+    json_key_index_t index;
+    char str_val[128];
+    int64_t int64_val;
+    const char *js = player_state_json_start;
+
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start(&jctx, js, strlen(js)));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_set_key_index(&jctx, &index));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, player_state_lookups(&jctx, str_val, sizeof(str_val)));
+    TEST_ASSERT_EQUAL_STRING("https://i.scdn.co/image/ab67616d00001e02e464904cc3fed2b40fc55120", str_val);
+
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_object(&jctx, "item"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "name", str_val, sizeof(str_val)));
+    TEST_ASSERT_EQUAL_STRING("Under Pressure - Remastered 2011", str_val);
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "nam", str_val, sizeof(str_val)));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_obj_get_int64(&jctx, "progress_ms", &int64_val));
+    json_obj_leave_object(&jctx);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_int64(&jctx, "progress_ms", &int64_val));
+    TEST_ASSERT(int64_val == 73514);
+
+    json_parse_end(&jctx);
+}
+
+typedef struct {
+    char id[30];
+    char *name;
+    char *album;
+    int64_t duration_ms;
+    int64_t progress_ms;
+    bool is_playing;
+    int volume;
+    char missing[8];
+} test_track_t;
+
+static const json_field_t test_track_fields[] = {
+    JSON_FIELD("item.id", JSON_FIELD_STRING, test_track_t, id),
+    JSON_FIELD("item.name", JSON_FIELD_DUP_STRING, test_track_t, name),
+    JSON_FIELD("item.album.name", JSON_FIELD_DUP_STRING, test_track_t, album),
+    JSON_FIELD("item.duration_ms", JSON_FIELD_INT64, test_track_t, duration_ms),
+    JSON_FIELD("progress_ms", JSON_FIELD_INT64, test_track_t, progress_ms),
+    JSON_FIELD("is_playing", JSON_FIELD_BOOL, test_track_t, is_playing),
+    JSON_FIELD("device.volume_percent", JSON_FIELD_INT, test_track_t, volume),
+    JSON_FIELD("item.album.nope", JSON_FIELD_STRING, test_track_t, missing),
+};
+
+TEST_CASE("json_parser extract tests", "[json_parser]")
+{
+    jparse_ctx_t jctx;
+    test_track_t track = { 0 };
+    uint32_t found;
+    const char *js = player_state_json_start;
+    const int num_fields = sizeof(test_track_fields) / sizeof(test_track_fields[0]);
+
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start(&jctx, js, strlen(js)));
+    /* The last field doesn't exist, everything else is still extracted */
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_obj_extract(&jctx, test_track_fields, num_fields, &track, &found));
+    TEST_ASSERT_EQUAL((1u << (num_fields - 1)) - 1, found);
+    TEST_ASSERT_EQUAL_STRING("11IzgLRXV7Cgek3tEgGgjw", track.id);
+    TEST_ASSERT_EQUAL_STRING("Under Pressure - Remastered 2011", track.name);
+    TEST_ASSERT_EQUAL_STRING("Hot Space (2011 Remaster)", track.album);
+    TEST_ASSERT(track.duration_ms == 248440);
+    TEST_ASSERT(track.progress_ms == 73514);
+    TEST_ASSERT_EQUAL(true, track.is_playing);
+    TEST_ASSERT_EQUAL_INT(42, track.volume);
+    free(track.name);
+    free(track.album);
+
+    /* Works on nested objects too */
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_object(&jctx, "item"));
+    static const json_field_t id_field[] = { JSON_FIELD("id", JSON_FIELD_STRING, test_track_t, id) };
+    memset(&track, 0, sizeof(track));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_extract(&jctx, id_field, 1, &track, NULL));
+    TEST_ASSERT_EQUAL_STRING("11IzgLRXV7Cgek3tEgGgjw", track.id);
+
+    json_parse_end(&jctx);
+}
+
+typedef struct {
+    char trace[256];
+    int len;
+    const char *match_path;
+    char match[32];
+} sax_trace_t;
+
+static int sax_trace_cb(json_sax_t *sax, const json_sax_evt_t *evt, void *arg)
+{
+    sax_trace_t *t = (sax_trace_t *) arg;
+    static const char *fmt[] = { "{", "}", "[", "]", "%.*s:", "\"%.*s\"", "%.*s" };
+    t->len += snprintf(t->trace + t->len, sizeof(t->trace) - t->len, fmt[evt->type], evt->len, evt->str);
+    if (t->match_path && evt->str && evt->type != JSON_SAX_KEY && json_sax_path_match(sax, 0, t->match_path)) {
+        snprintf(t->match, sizeof(t->match), "%.*s", evt->len, evt->str);
+    }
+    return OS_SUCCESS;
+}
+
+static int sax_skip_cb(json_sax_t *sax, const json_sax_evt_t *evt, void *arg)
+{
+    sax_trace_cb(sax, evt, arg);
+    return (evt->type == JSON_SAX_ARRAY_START && json_sax_path_match(sax, 0, "b")) ? JSON_SAX_SKIP : OS_SUCCESS;
+}
+
+TEST_CASE("json_parser sax tests", "[json_parser]")
+{
+    const char *js = "{ \"a\": \"x\\\"y\", \"b\": [1, {\"c\": true}, []], \"d\": {}, \"e\": -2.5 }";
+    const char *expected = "{a:\"x\\\"y\"b:[1{c:true}[]]d:{}e:-2.5}";
+    sax_trace_t t = { .match_path = "b[].c" };
+
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_parse(js, strlen(js), sax_trace_cb, &t));
+    TEST_ASSERT_EQUAL_STRING(expected, t.trace);
+    TEST_ASSERT_EQUAL_STRING("true", t.match);
+
+    /* Same events when the bytes arrive one at a time */
+    json_sax_t sax;
+    memset(&t, 0, sizeof(t));
+    json_sax_begin(&sax, sax_trace_cb, &t);
+    for (int i = 1; i <= (int) strlen(js); i++) {
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_feed(&sax, js, i));
+    }
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_finish(&sax));
+    TEST_ASSERT_EQUAL_STRING(expected, t.trace);
+
+    /* Skipped content isn't reported, even split anywhere */
+    for (int step = 1; step <= (int) strlen(js); step += strlen(js) - 1) {
+        memset(&t, 0, sizeof(t));
+        json_sax_begin(&sax, sax_skip_cb, &t);
+        for (int i = step; i < (int) strlen(js) + step; i += step) {
+            TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_feed(&sax, js, i < (int) strlen(js) ? i : (int) strlen(js)));
+        }
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_finish(&sax));
+        TEST_ASSERT_EQUAL_STRING("{a:\"x\\\"y\"b:[]d:{}e:-2.5}", t.trace);
+    }
+
+    /* Collected by a stream without tokens */
+    jparse_ctx_t jctx;
+    char buf[128];
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_begin(&jctx, buf, sizeof(buf), NULL, 0));
+    json_sax_begin(&sax, NULL, NULL);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_set_sax(&jctx, &sax));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_feed(&jctx, js, 20));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_parse_stream_finish(&jctx));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_feed(&jctx, js + 20, strlen(js) - 20));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_finish(&jctx));
+    TEST_ASSERT_NULL(strchr(buf, ' '));
+    json_parse_end_static(&jctx);
+
+    /* A number at the root only ends with the data */
+    json_sax_begin(&sax, NULL, NULL);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_feed(&sax, "42", 2));
+    TEST_ASSERT_EQUAL(JSON_SAX_PART, sax.status);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_finish(&sax));
+
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_sax_parse("{\"a\":}", 6, NULL, NULL));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_sax_parse("[1}", 3, NULL, NULL));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_sax_parse("{\"a\" 1}", 7, NULL, NULL));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_sax_parse("{\"a\":[1,2]", 10, NULL, NULL));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_sax_parse("{} {}", 5, NULL, NULL));
+    const char *deep = "[[[[[[[[[[[[[[[[[]]]]]]]]]]]]]]]]]";
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_sax_parse(deep, strlen(deep), NULL, NULL));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_parse(deep + 1, strlen(deep) - 2, NULL, NULL));
+
+    /* Escapes as jsmn takes them, skipped strings included */
+    const char *escapes = "[\"\\\"\\\\\\/\\b\\f\\n\\r\\t\\u00e9\\uD83C\\udfb5\"]";
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_parse(escapes, strlen(escapes), NULL, NULL));
+    const char *bad[] = { "[\"\\q\"]", "{\"\\q\":1}", "[\"\\u00zz\"]", "[\"\\u00e\"]" };
+    for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_sax_parse(bad[i], strlen(bad[i]), NULL, NULL));
+    }
+    const char *skipped = "{\"b\":[\"\\q\"]}";
+    memset(&t, 0, sizeof(t));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_sax_parse(skipped, strlen(skipped), sax_skip_cb, &t));
+    /* An escape split by the chunks waits for the rest */
+    const char *split = "[\"\\u00e9\"]";
+    json_sax_begin(&sax, NULL, NULL);
+    for (int i = 1; i <= (int) strlen(split); i++) {
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_feed(&sax, split, i));
+    }
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_finish(&sax));
+
+    /* Every token of a real response is seen */
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_parse(player_state_json_start, strlen(player_state_json_start), NULL, NULL));
+}
+
+static int sax_store_cb(json_sax_t *sax, const json_sax_evt_t *evt, void *arg)
+{
+    static const json_field_t volume = JSON_FIELD("device.volume_percent", JSON_FIELD_INT, test_track_t, volume);
+    static const json_field_t name = JSON_FIELD("device.name", JSON_FIELD_INT, test_track_t, volume);
+    /* The keys are on the same paths */
+    if (evt->type != JSON_SAX_STRING && evt->type != JSON_SAX_PRIMITIVE) {
+        return OS_SUCCESS;
+    }
+    if (json_sax_path_match(sax, 0, volume.path)) {
+        return json_sax_field_store(sax, evt, &volume, arg);
+    }
+    /* Not a number */
+    if (json_sax_path_match(sax, 0, name.path) && json_sax_field_store(sax, evt, &name, arg) == OS_SUCCESS) {
+        return -OS_FAIL;
+    }
+    return OS_SUCCESS;
+}
+
+static int sax_key_store_cb(json_sax_t *sax, const json_sax_evt_t *evt, void *arg)
+{
+    static const json_field_t volume = JSON_FIELD("device.volume_percent", JSON_FIELD_INT, test_track_t, volume);
+    if (evt->type == JSON_SAX_KEY && json_sax_path_match(sax, 0, volume.path)) {
+        /* Only values are stored */
+        TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_sax_field_store(sax, evt, &volume, arg));
+        TEST_ASSERT_EQUAL_INT(-1, ((test_track_t *) arg)->volume);
+    }
+    return OS_SUCCESS;
+}
+
+TEST_CASE("json_parser sax extract tests", "[json_parser]")
+{
+    test_track_t track = { 0 };
+    uint32_t found;
+    const char *js = player_state_json_start;
+    const int num_fields = sizeof(test_track_fields) / sizeof(test_track_fields[0]);
+
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_sax_extract(js, strlen(js), NULL, test_track_fields, num_fields, &track, &found));
+    TEST_ASSERT_EQUAL((1u << (num_fields - 1)) - 1, found);
+    TEST_ASSERT_EQUAL_STRING("11IzgLRXV7Cgek3tEgGgjw", track.id);
+    TEST_ASSERT_EQUAL_STRING("Under Pressure - Remastered 2011", track.name);
+    TEST_ASSERT_EQUAL_STRING("Hot Space (2011 Remaster)", track.album);
+    TEST_ASSERT(track.duration_ms == 248440);
+    TEST_ASSERT(track.progress_ms == 73514);
+    TEST_ASSERT_EQUAL(true, track.is_playing);
+    TEST_ASSERT_EQUAL_INT(42, track.volume);
+    free(track.name);
+    free(track.album);
+
+    /* Paths are relative to the root object, the first match is used */
+    const char *msg = "{\"payloads\":[\"x\",{\"events\":[{\"type\":\"A\",\"event\":{\"state\":{\"id\":\"one\"}}},"
+                      "{\"type\":\"B\"}]}]}";
+    static const json_field_t id_field[] = { JSON_FIELD("event.state.id", JSON_FIELD_STRING, test_track_t, id) };
+    memset(&track, 0, sizeof(track));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_extract(msg, strlen(msg), "payloads[].events[]", id_field, 1, &track, NULL));
+    TEST_ASSERT_EQUAL_STRING("one", track.id);
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_sax_extract(msg, strlen(msg), "payloads[].nope", id_field, 1, &track, NULL));
+
+    /* Callbacks store the elements they want themselves */
+    memset(&track, 0, sizeof(track));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_parse(js, strlen(js), sax_store_cb, &track));
+    TEST_ASSERT_EQUAL_INT(42, track.volume);
+    track.volume = -1;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_sax_parse(js, strlen(js), sax_key_store_cb, &track));
+}
+
+TEST_CASE("json_parser arena tests", "[json_parser]")
+{
+    static json_tok_t tokens[600];
+    json_tok_arena_t arena;
+    jparse_ctx_t big, small, heap;
+    const char *js = player_state_json_start;
+    int volume;
+
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_tok_arena_init(&arena, tokens, 600));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start_arena(&big, js, strlen(js), &arena));
+    TEST_ASSERT_EQUAL_INT(555, arena.used);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start_arena(&small, "{\"a\":1}", 7, &arena));
+    TEST_ASSERT_EQUAL_INT(558, arena.used);
+    /* Doesn't fit anymore, taken from the heap */
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start_arena(&heap, js, strlen(js), &arena));
+    TEST_ASSERT_EQUAL_INT(558, arena.used);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_object(&heap, "device"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_int(&heap, "volume_percent", &volume));
+    TEST_ASSERT_EQUAL_INT(42, volume);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_int(&small, "a", &volume));
+    TEST_ASSERT_EQUAL_INT(1, volume);
+    json_parse_end_arena(&heap);
+    json_parse_end_arena(&small);
+    TEST_ASSERT_EQUAL_INT(555, arena.used);
+    json_parse_end_arena(&big);
+    TEST_ASSERT_EQUAL_INT(0, arena.used);
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_parse_start_arena(&big, "{\"a\":", 5, &arena));
+    TEST_ASSERT_EQUAL_INT(0, arena.used);
+
+    /* Streams keep only the tokens they used, or move to the heap */
+    static char buf[9000];
+    for (int size = 600; size >= 100; size -= 500) {
+        json_tok_arena_init(&arena, tokens, size);
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_begin_arena(&big, buf, sizeof(buf), &arena));
+        for (int i = 0; i < (int) strlen(js); i += 1000) {
+            int len = strlen(js + i) < 1000 ? strlen(js + i) : 1000;
+            TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_feed(&big, js + i, len));
+        }
+        TEST_ASSERT_EQUAL_INT(0, arena.used);
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_stream_finish(&big));
+        TEST_ASSERT_EQUAL_INT(size == 600 ? 555 : 0, arena.used);
+        TEST_ASSERT_EQUAL_INT(555, big.num_tokens);
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_object(&big, "device"));
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_int(&big, "volume_percent", &volume));
+        TEST_ASSERT_EQUAL_INT(42, volume);
+        json_parse_end_arena(&big);
+        TEST_ASSERT_EQUAL_INT(0, arena.used);
+    }
+}
+
+TEST_CASE("json_parser path tests", "[json_parser]")
+{
+    jparse_ctx_t jctx;
+    json_path_t path;
+    char str[80];
+    int val;
+
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "item.album.images[1].url"));
+    TEST_ASSERT_EQUAL_INT(5, path.num_steps);
+    TEST_ASSERT_NULL(path.steps[3].key);
+    TEST_ASSERT_EQUAL_INT(1, path.steps[3].index);
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_path_compile(&path, "item..id"));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_path_compile(&path, "item."));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_path_compile(&path, "images[x]"));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_path_compile(&path, "images[1]url"));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_path_compile(&path, "a.b.c.d.e.f.g.h.i.j.k.l.m"));
+
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start(&jctx, player_state_json_start, strlen(player_state_json_start)));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "item.album.images[1].url"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_find(&jctx, &path));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_string(&jctx, str, sizeof(str)));
+    TEST_ASSERT_EQUAL_STRING("https://i.scdn.co/image/ab67616d00001e02e464904cc3fed2b40fc55120", str);
+    /* Relative to the cursor, which stays put when the path isn't there */
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_leave_object(&jctx));
+    json_tok_t *image = jctx.cur;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "height"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_find(&jctx, &path));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_int(&jctx, &val));
+    TEST_ASSERT_EQUAL_INT(300, val);
+    jctx.cur = image;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "nope"));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_path_find(&jctx, &path));
+    TEST_ASSERT(jctx.cur == image);
+    json_parse_end(&jctx);
+
+    static const char *strs[] = {
+        "item.artists[1].name", "item.album.images[2].height", "item.album.images[9]",
+        "item.album.name", "device.volume_percent", "",
+    };
+    json_path_t paths[6];
+    json_tok_t *elems[6];
+    for (int i = 0; i < 6; i++) {
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&paths[i], strs[i]));
+    }
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start(&jctx, player_state_json_start, strlen(player_state_json_start)));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_path_find_batch(&jctx, paths, 6, elems));
+    TEST_ASSERT(jctx.cur == jctx.tokens);
+    TEST_ASSERT_NULL(elems[2]);
+    TEST_ASSERT(elems[5] == jctx.tokens);
+    jctx.cur = elems[0];
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_string(&jctx, str, sizeof(str)));
+    TEST_ASSERT_EQUAL_STRING("David Bowie", str);
+    jctx.cur = elems[1];
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_int(&jctx, &val));
+    TEST_ASSERT_EQUAL_INT(64, val);
+    jctx.cur = elems[3];
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_string(&jctx, str, sizeof(str)));
+    TEST_ASSERT_EQUAL_STRING("Hot Space (2011 Remaster)", str);
+    jctx.cur = elems[4];
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_int(&jctx, &val));
+    TEST_ASSERT_EQUAL_INT(42, val);
+    json_parse_end(&jctx);
+}
+
+TEST_CASE("json_parser escape tests", "[json_parser]")
+{
+    char js[] = "{\"name\":\"Caf\\u00e9 \\\"Tacuba\\\"\",\"emoji\":\"\\ud83c\\udfb5 a\\/b\\n\","
+                "\"lone\":\"\\udc00x\",\"plain\":\"abc\",\"list\":[\"\\u20ac\"]}";
+    jparse_ctx_t jctx;
+    char str[32];
+    json_str_t view;
+
+    /* Copies are decoded, views aren't until the data is unescaped */
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start(&jctx, js, strlen(js)));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "name", str, sizeof(str)));
+    TEST_ASSERT_EQUAL_STRING("Caf\xc3\xa9 \"Tacuba\"", str);
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "name", str, strlen("Caf\xc3\xa9 \"Tacuba\"")));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "emoji", str, sizeof(str)));
+    TEST_ASSERT_EQUAL_STRING("\xf0\x9f\x8e\xb5 a/b\n", str);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "lone", str, sizeof(str)));
+    TEST_ASSERT_EQUAL_STRING("\xef\xbf\xbdx", str);
+    char *dup;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_dup_string(&jctx, "name", &dup));
+    TEST_ASSERT_EQUAL_STRING("Caf\xc3\xa9 \"Tacuba\"", dup);
+    free(dup);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_strview(&jctx, "name", &view));
+    TEST_ASSERT_EQUAL_INT(strlen("Caf\\u00e9 \\\"Tacuba\\\""), view.len);
+
+    /* Decoded in place, each string only once */
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_unescape(&jctx));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_unescape(&jctx));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_strview(&jctx, "name", &view));
+    TEST_ASSERT_EQUAL_INT(strlen("Caf\xc3\xa9 \"Tacuba\""), view.len);
+    TEST_ASSERT_EQUAL_MEMORY("Caf\xc3\xa9 \"Tacuba\"", view.str, view.len);
+    TEST_ASSERT(view.str > js && view.str < js + sizeof(js));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "name", str, sizeof(str)));
+    TEST_ASSERT_EQUAL_STRING("Caf\xc3\xa9 \"Tacuba\"", str);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_strview(&jctx, "plain", &view));
+    TEST_ASSERT_EQUAL_MEMORY("abc", view.str, 3);
+    int num;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_array(&jctx, "list", &num));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_arr_get_strview(&jctx, 0, &view));
+    TEST_ASSERT_EQUAL_INT(3, view.len);
+    TEST_ASSERT_EQUAL_MEMORY("\xe2\x82\xac", view.str, 3);
+    json_obj_leave_array(&jctx);
+
+    typedef struct {
+        json_str_t name;
+        json_str_t plain;
+    } views_t;
+    static const json_field_t fields[] = {
+        JSON_FIELD("name", JSON_FIELD_STR_VIEW, views_t, name),
+        JSON_FIELD("plain", JSON_FIELD_STR_VIEW, views_t, plain),
+    };
+    views_t views;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_extract(&jctx, fields, 2, &views, NULL));
+    TEST_ASSERT_EQUAL_MEMORY("Caf\xc3\xa9", views.name.str, 5);
+    TEST_ASSERT_EQUAL_INT(3, views.plain.len);
+    json_parse_end(&jctx);
+
+    char bad[] = "a\\x";
+    TEST_ASSERT(json_str_unescape(bad, strlen(bad)) < 0);
+    char cut[] = "\\u00";
+    TEST_ASSERT(json_str_unescape(cut, strlen(cut)) < 0);
+    char ok[] = "\\\\u0041";
+    TEST_ASSERT_EQUAL_INT(6, json_str_unescape(ok, strlen(ok)));
+    TEST_ASSERT_EQUAL_MEMORY("\\u0041", ok, 6);
+}
+
+TEST_CASE("json_parser query tests", "[json_parser]")
+{
+    static json_tok_t tokens[600];
+    json_tok_arena_t arena;
+    jparse_ctx_t jctx;
+    const char *js = player_state_json_start;
+    char str[80];
+    int val;
+    bool playing;
+    json_tok_arena_init(&arena, tokens, 600);
+
+    static const char *strs[] = {
+        "item.id", "progress_ms", "item.artists", "item.album.images[1].url", "is_playing", "item.nope",
+    };
+    json_path_t paths[6];
+    for (int i = 0; i < 6; i++) {
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&paths[i], strs[i]));
+    }
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start_query(&jctx, js, strlen(js), &arena, paths, 6));
+    TEST_ASSERT_EQUAL_INT(49, jctx.num_tokens);
+    TEST_ASSERT_EQUAL_INT(jctx.num_tokens, arena.used);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_int(&jctx, "progress_ms", &val));
+    TEST_ASSERT_EQUAL_INT(73514, val);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_bool(&jctx, "is_playing", &playing));
+    TEST_ASSERT(playing);
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_obj_get_object(&jctx, "device"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_object(&jctx, "item"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "id", str, sizeof(str)));
+    TEST_ASSERT_EQUAL_STRING("11IzgLRXV7Cgek3tEgGgjw", str);
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "name", str, sizeof(str)));
+    json_iter_t it;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_array(&jctx, "artists", &val));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_arr_iter_begin(&jctx, &it));
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_arr_iter_next(&jctx, &it));
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "name", str, sizeof(str)));
+        TEST_ASSERT_EQUAL_STRING(i ? "David Bowie" : "Queen", str);
+    }
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_arr_iter_next(&jctx, &it));
+    json_obj_leave_array(&jctx);
+    /* The first image is there, empty, so the second keeps its index */
+    jctx.cur = jctx.tokens;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_find(&jctx, &paths[3]));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_string(&jctx, str, sizeof(str)));
+    TEST_ASSERT_EQUAL_STRING("https://i.scdn.co/image/ab67616d00001e02e464904cc3fed2b40fc55120", str);
+    json_parse_end_arena(&jctx);
+    TEST_ASSERT_EQUAL_INT(0, arena.used);
+
+    /* The scan ends once every path is resolved, what follows isn't read */
+    const char *cut = "{\"a\":[{\"x\":1},[2,3],\"s\",{\"y\":2},5],\"b\":1,\"c\": oops";
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&paths[0], "a[3].y"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&paths[1], "b"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start_query(&jctx, cut, strlen(cut), &arena, paths, 2));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_find(&jctx, &paths[0]));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_int(&jctx, &val));
+    TEST_ASSERT_EQUAL_INT(2, val);
+    jctx.cur = jctx.tokens;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_int(&jctx, "b", &val));
+    TEST_ASSERT_EQUAL_INT(1, val);
+    json_parse_end_arena(&jctx);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&paths[2], "d"));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_parse_start_query(&jctx, cut, strlen(cut), &arena, paths, 3));
+    TEST_ASSERT_EQUAL_INT(0, arena.used);
+
+    /* Too many tokens for the arena: all of them are taken from the heap */
+    json_tok_arena_init(&arena, tokens, 4);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&paths[0], "item.artists"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start_query(&jctx, js, strlen(js), &arena, paths, 1));
+    TEST_ASSERT_EQUAL_INT(555, jctx.num_tokens);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_object(&jctx, "device"));
+    json_parse_end_arena(&jctx);
+    TEST_ASSERT_EQUAL_INT(0, arena.used);
+}
+
+TEST_CASE("json_parser raw tests", "[json_parser]")
+{
+    const char *js = player_state_json_start;
+    int len = strlen(js);
+    json_path_t path;
+    json_tok_t tok, item;
+    jparse_ctx_t raw = { .js = js, .cur = &tok };
+    char str[32];
+    int val;
+    bool playing;
+
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "item"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_raw_find(js, len, 0, &path, &item));
+    TEST_ASSERT_EQUAL(JSMN_OBJECT, item.type);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "id"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_raw_find(js, len, item.start, &path, &tok));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_string(&raw, str, sizeof(str)));
+    TEST_ASSERT_EQUAL_STRING("11IzgLRXV7Cgek3tEgGgjw", str);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "progress_ms"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_raw_find(js, len, 0, &path, &tok));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_int(&raw, &val));
+    TEST_ASSERT_EQUAL_INT(73514, val);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "is_playing"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_raw_find(js, len, 0, &path, &tok));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_bool(&raw, &playing));
+    TEST_ASSERT(playing);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "item.album.images[2].height"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_raw_find(js, len, 0, &path, &tok));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_int(&raw, &val));
+    TEST_ASSERT_EQUAL_INT(64, val);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "item.artists[1].name"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_raw_find(js, len, 0, &path, &tok));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_string(&raw, str, sizeof(str)));
+    TEST_ASSERT_EQUAL_STRING("David Bowie", str);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "item.album.images[3]"));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_raw_find(js, len, 0, &path, &tok));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "item.nope"));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_raw_find(js, len, 0, &path, &tok));
+
+    /* Only members of the object itself match, not nested ones nor values */
+    const char *nested = "{\"a\": {\"id\": 1}, \"b\": [\"id\", {\"id\": 0}], \"c\": \"id\", \"id\" : 2}";
+    raw.js = nested;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "id"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_raw_find(nested, strlen(nested), 0, &path, &tok));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_int(&raw, &val));
+    TEST_ASSERT_EQUAL_INT(2, val);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "b[1].id"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_raw_find(nested, strlen(nested), 0, &path, &tok));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_int(&raw, &val));
+    TEST_ASSERT_EQUAL_INT(0, val);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&path, "b[2]"));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_raw_find(nested, strlen(nested), 0, &path, &tok));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_raw_find("[]", 2, 0, &path, &tok));
+
+    /* Many paths in one pass, the ones found are filled in anyway */
+    json_path_t paths[4];
+    json_tok_t toks[4];
+    raw.js = js;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&paths[0], "is_playing"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&paths[1], "item.id"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&paths[2], "item"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&paths[3], "item.album.images[0].width"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_raw_find_batch(js, len, 0, paths, 4, toks));
+    TEST_ASSERT_EQUAL(JSMN_PRIMITIVE, toks[0].type);
+    TEST_ASSERT_EQUAL(JSMN_OBJECT, toks[2].type);
+    TEST_ASSERT_EQUAL_INT(item.start, toks[2].start);
+    raw.cur = &toks[1];
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_string(&raw, str, sizeof(str)));
+    TEST_ASSERT_EQUAL_STRING("11IzgLRXV7Cgek3tEgGgjw", str);
+    raw.cur = &toks[3];
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_cur_get_int(&raw, &val));
+    TEST_ASSERT_EQUAL_INT(640, val);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&paths[2], "item.nope"));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_raw_find_batch(js, len, 0, paths, 4, toks));
+    TEST_ASSERT_EQUAL(JSMN_UNDEFINED, toks[2].type);
+    TEST_ASSERT_EQUAL(JSMN_PRIMITIVE, toks[0].type);
+}
+
+typedef struct {
+    char buf[256];
+    int len;
+    int flushes;
+    int fail_at;    /* flush that fails, 0 for none */
+} gen_out_t;
+
+static int gen_flush_cb(const char *buf, int len, void *priv)
+{
+    gen_out_t *out = priv;
+    if (++out->flushes == out->fail_at || out->len + len >= (int) sizeof(out->buf)) {
+        return -OS_FAIL;
+    }
+    memcpy(out->buf + out->len, buf, len);
+    out->len += len;
+    out->buf[out->len] = 0;
+    return OS_SUCCESS;
+}
+
+static int gen_play_body(json_gen_str_t *jstr)
+{
+    json_gen_start_object(jstr);
+    json_gen_push_array(jstr, "uris");
+    json_gen_arr_set_string(jstr, "spotify:track:1");
+    json_gen_arr_set_string(jstr, "spotify:track:2");
+    json_gen_pop_array(jstr);
+    json_gen_push_object(jstr, "offset");
+    json_gen_obj_set_int(jstr, "position", 1);
+    json_gen_pop_object(jstr);
+    json_gen_obj_set_int(jstr, "position_ms", 4294967296LL);
+    json_gen_obj_set_string(jstr, "name", "\"Heroes\"\t\\ \x01 caf\xc3\xa9");
+    json_gen_obj_set_string(jstr, "none", NULL);
+    json_gen_push_array(jstr, "flags");
+    json_gen_arr_set_bool(jstr, true);
+    json_gen_arr_set_bool(jstr, false);
+    json_gen_arr_set_null(jstr);
+    json_gen_arr_set_int(jstr, -7);
+    json_gen_pop_array(jstr);
+    json_gen_push_array(jstr, "empty");
+    json_gen_pop_array(jstr);
+    json_gen_end_object(jstr);
+    return json_gen_str_end(jstr);
+}
+
+TEST_CASE("json_parser generator tests", "[json_parser]")
+{
+    const char *expected = "{\"uris\":[\"spotify:track:1\",\"spotify:track:2\"],\"offset\":{\"position\":1},"
+                           "\"position_ms\":4294967296,\"name\":\"\\\"Heroes\\\"\\t\\\\ \\u0001 caf\xc3\xa9\","
+                           "\"none\":null,\"flags\":[true,false,null,-7],\"empty\":[]}";
+    json_gen_str_t jstr;
+    gen_out_t out = { 0 };
+    char buf[7];
+
+    /* Only counted first, as for a Content-Length */
+    json_gen_str_start(&jstr, NULL, 0, NULL, NULL);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, gen_play_body(&jstr));
+    TEST_ASSERT_EQUAL_INT(strlen(expected), jstr.len);
+
+    /* Flushed in chunks of the buffer size */
+    json_gen_str_start(&jstr, buf, sizeof(buf), gen_flush_cb, &out);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, gen_play_body(&jstr));
+    TEST_ASSERT_EQUAL_STRING(expected, out.buf);
+    TEST_ASSERT_EQUAL_INT(strlen(expected), jstr.len);
+    TEST_ASSERT_EQUAL_INT((jstr.len + sizeof(buf) - 1) / sizeof(buf), out.flushes);
+
+    /* It reads back */
+    jparse_ctx_t jctx;
+    char str[32];
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start(&jctx, out.buf, out.len));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_string(&jctx, "name", str, sizeof(str)));
+    TEST_ASSERT_EQUAL_STRING("\"Heroes\"\t\\ \x01 caf\xc3\xa9", str);
+    json_parse_end(&jctx);
+
+    /* A failed flush fails the rest */
+    memset(&out, 0, sizeof(out));
+    out.fail_at = 2;
+    json_gen_str_start(&jstr, buf, sizeof(buf), gen_flush_cb, &out);
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, gen_play_body(&jstr));
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), out.len);
+    TEST_ASSERT_EQUAL_INT(2, out.flushes);
+}
+
+/* Replays dealer messages the way they usually come: progress updates of the
+ * same track, and a new track every 25 messages. They are made from the
+ * captured player state, patched in place between events. Their timings are
+ * spotify_client/host_bench's */
+TEST_CASE("json_parser dealer event tests", "[json_parser]")
+{
+    const int events = 100;
+    const int num_tokens = 1000, msg_size = 10 * 1024;
+    json_tok_t *tokens = malloc(num_tokens * sizeof(json_tok_t));
+    char *msg = malloc(msg_size);
+    json_tok_arena_t arena;
+    jparse_ctx_t jctx;
+    char id[32] = "11IzgLRXV7Cgek3tEgGgjw";
+    int64_t progress = 0;
+    bool playing = false;
+
+    TEST_ASSERT_NOT_NULL(tokens);
+    TEST_ASSERT_NOT_NULL(msg);
+    snprintf(msg, msg_size, "{\"headers\":{\"Content-Type\":\"application/json\"},\"payloads\":[{\"events\":["
+             "{\"type\":\"PLAYER_STATE_CHANGED\",\"event\":{\"state\":%s}}]}],\"type\":\"message\"}",
+             player_state_json_start);
+    /* Sent without whitespace */
+    int len = 0;
+    bool in_string = false;
+    for (char *c = msg; *c; c++) {
+        if (*c == '\"' && (c == msg || c[-1] != '\\')) {
+            in_string = !in_string;
+        }
+        if (in_string || !strchr(" \t\r\n", *c)) {
+            msg[len++] = *c;
+        }
+    }
+    msg[len] = 0;
+    char *progress_at = strstr(msg, "73514");
+    char *id_at = strstr(msg, "\"id\":\"11Izg") + 6;
+    TEST_ASSERT_NOT_NULL(progress_at);
+    json_tok_arena_init(&arena, tokens, num_tokens);
+
+    static const char *strs[] = {
+        "payloads[0].events[0].type",
+        "payloads[0].events[0].event.state.item.id",
+        "payloads[0].events[0].event.state.progress_ms",
+        "payloads[0].events[0].event.state.is_playing",
+    };
+    json_path_t paths[4];
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_compile(&paths[i], strs[i]));
+    }
+
+    int same = 0;
+    for (int variant = 0; variant < 3; variant++) {
+        for (int i = 0; i < events; i++) {
+            memcpy(progress_at, (char[]) { '1' + i % 9, '0' + i / 10 % 10, '0' + i % 10, '0', '0' }, 5);
+            memcpy(id_at, (i / 25 % 2) ? "22" : "11", 2);
+            if (variant == 0) {
+                /* Everything tokenized, as before queries */
+                TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start_arena(&jctx, msg, len, &arena));
+                for (int p = 1; p < 4; p++) {
+                    jctx.cur = jctx.tokens;
+                    TEST_ASSERT_EQUAL(OS_SUCCESS, json_path_find(&jctx, &paths[p]));
+                }
+                json_parse_end_arena(&jctx);
+            } else if (variant == 1) {
+                TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start_query(&jctx, msg, len, &arena, paths, 4));
+                json_parse_end_arena(&jctx);
+            } else {
+                /* Raw check of the track, tokens only for a new one */
+                jparse_ctx_t raw = { .js = msg };
+                json_tok_t found[4];
+                json_str_t view;
+                TEST_ASSERT_EQUAL(OS_SUCCESS, json_raw_find_batch(msg, len, 0, paths, 4, found));
+                raw.cur = &found[1];
+                json_cur_get_strview(&raw, &view);
+                if (view.len == (int) strlen(id) && memcmp(view.str, id, view.len) == 0) {
+                    raw.cur = &found[2];
+                    json_cur_get_int64(&raw, &progress);
+                    raw.cur = &found[3];
+                    json_cur_get_bool(&raw, &playing);
+                    same++;
+                } else {
+                    memcpy(id, view.str, view.len);
+                    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start_query(&jctx, msg, len, &arena, paths, 4));
+                    json_parse_end_arena(&jctx);
+                }
+            }
+        }
+    }
+    /* The first message has the track already known */
+    TEST_ASSERT_EQUAL_INT(events - (events - 1) / 25, same);
+    int last = events - 1;
+    TEST_ASSERT_EQUAL_INT((1 + last % 9) * 10000 + last / 10 % 10 * 1000 + last % 10 * 100, progress);
+    TEST_ASSERT(playing);
+    free(msg);
+    free(tokens);
+}
+
+#ifdef JSMN_COMPACT_TOKENS
+TEST_CASE("json_parser compact token tests", "[json_parser]")
+{
+    jparse_ctx_t jctx;
+    TEST_ASSERT(sizeof(json_tok_t) <= 12);
+
+    /* Same results as with full size tokens */
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start(&jctx, player_state_json_start, strlen(player_state_json_start)));
+    int volume;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_object(&jctx, "device"));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_int(&jctx, "volume_percent", &volume));
+    TEST_ASSERT_EQUAL_INT(42, volume);
+    json_parse_end(&jctx);
+
+    /* Offsets past 64 KB can't be represented */
+    int len = 70 * 1024;
+    char *js = malloc(len + 1);
+    TEST_ASSERT_NOT_NULL(js);
+    memset(js, ' ', len);
+    js[0] = '[';
+    js[len - 1] = ']';
+    js[len] = 0;
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_parse_start(&jctx, js, len));
+    free(js);
+}
+#endif
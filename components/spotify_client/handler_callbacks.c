@@ -24,27 +24,28 @@ static const char *TAG = "HANDLER_CALLBACKS";
 /* External variables declarations -------------------------------------------*/
 
 /* Private function prototypes -----------------------------------------------*/
-size_t static inline memcpy_trimmed(char *dest, int dest_size, const char *src, size_t src_len);
 
 /* Exported functions --------------------------------------------------------*/
 esp_err_t json_http_event_cb(esp_http_client_event_t *evt)
 {
     evt_user_data_t *user_data = evt->user_data;
-    char *buffer = (char *)user_data->buffer;
-    size_t buffer_size = user_data->buffer_size;
-    static int output_len; // Stores efective number of bytes stored
+    jparse_ctx_t *jctx = &user_data->jctx;
 
     switch (evt->event_id)
     {
+    case HTTP_EVENT_HEADERS_SENT:
+        // a new request (or a retry) starts, so does the response
+        parse_json_stream_start(jctx, (char *)user_data->buffer, user_data->buffer_size);
+        user_data->current_size = 0;
+        break;
     case HTTP_EVENT_ON_DATA:
         ESP_LOGD(TAG, "CHUNK DATA:\n%.*s", evt->data_len, (char *)evt->data);
-        size_t stored = memcpy_trimmed(buffer + output_len, buffer_size - output_len, evt->data, evt->data_len);
-        output_len += stored;
-        user_data->current_size = output_len;
-        break;
-    case HTTP_EVENT_ON_FINISH:
-        buffer[output_len] = 0;
-        output_len = 0;
+        // tokenize while the rest of the body is still on its way
+        if (json_parse_stream_feed(jctx, evt->data, evt->data_len) != OS_SUCCESS)
+        {
+            ESP_LOGE(TAG, "Invalid JSON or response too big, status: %d", jctx->stream.status);
+        }
+        user_data->current_size = jctx->stream.len;
         break;
     case HTTP_EVENT_DISCONNECTED:
         int mbedtls_err = 0;
@@ -53,8 +54,6 @@ esp_err_t json_http_event_cb(esp_http_client_event_t *evt)
         {
             ESP_LOGI(TAG, "Last esp error code: 0x%x", err);
             ESP_LOGI(TAG, "Last mbedtls failure: 0x%x", mbedtls_err);
-            buffer[output_len] = 0;
-            output_len = 0;
         }
         break;
     default:
@@ -104,7 +103,16 @@ void default_ws_event_cb(void *handler_args, esp_event_base_t base, int32_t even
                     portMAX_DELAY);
                 user_data->current_size = 0;
             }
-            assert((data->payload_len) + 1 <= buffer_size); // TODO: don't use assert
+            if ((data->payload_len) + 1 > buffer_size)
+            {
+                // dropped, the client is ready for the next message
+                if (data->payload_offset + data->data_len == data->payload_len)
+                {
+                    ESP_LOGE(TAG, "Message of %d bytes dropped, the buffer has %d", data->payload_len, (int)buffer_size);
+                    xEventGroupSetBits(event_group, WS_READY_FOR_DATA);
+                }
+                break;
+            }
             memcpy(buffer + data->payload_offset, data->data_ptr, data->data_len);
             if (data->payload_offset + data->data_len == data->payload_len)
             {
@@ -195,6 +203,7 @@ esp_err_t playlist_http_event_cb(esp_http_client_event_t *evt)
     static const char *items_key = "\"items\"";
     static int in_items = 0;    // Bandera para indicar si estamos dentro del arreglo "items"
     static int brace_count = 0; // Contador de llaves para detectar el final de un elemento
+    static int too_long = 0;    // the playlist doesn't fit in the buffer, it's left out
 
     char *src = (char *)evt->data;
     int src_len = evt->data_len;
@@ -240,8 +249,10 @@ esp_err_t playlist_http_event_cb(esp_http_client_event_t *evt)
             }
             if (brace_count > 0)
             {
-                assert((user_data->current_size) < (user_data->buffer_size) - 1); // TODO: dont use assert
-                buffer[(user_data->current_size)++] = src[i];
+                if ((user_data->current_size) < (user_data->buffer_size) - 1)
+                    buffer[(user_data->current_size)++] = src[i];
+                else
+                    too_long = 1;
             }
             if (src[i] == '}')
             {
@@ -251,20 +262,35 @@ esp_err_t playlist_http_event_cb(esp_http_client_event_t *evt)
                     // End of playlist
                     buffer[(user_data->current_size)] = '\0';
                     ESP_LOGD(TAG, "Playlist (len: %d):\n%s", strlen(buffer), buffer);
-                    PlaylistItem_t *item = malloc(sizeof(*item));
-                    assert(item);
-                    parse_playlist(buffer, item);
-                    assert(spotify_append_item_to_list(playlists, (void *)item));
-                    (user_data->current_size) = 0;
+                    PlaylistItem_t *item = calloc(1, sizeof(*item));
+                    jparse_ctx_t jctx;
+                    if (item && !too_long && parse_json_start(&jctx, buffer) == ESP_OK)
+                    {
+                        esp_err_t err = parse_playlist(&jctx, item);
+                        parse_json_end(&jctx);
+                        if (err == ESP_OK && spotify_append_item_to_list(playlists, (void *)item))
+                        {
+                            item = NULL;
+                        }
+                    }
+                    if (item)
+                    {
+                        // the other playlists are still listed
+                        ESP_LOGW(TAG, "Playlist left out%s", too_long ? ", too long" : "");
+                        free(item->name);
+                        free(item->uri);
+                        free(item);
+                    }
+                    (user_data->current_size) = too_long = 0;
                 }
             }
         }
         break;
     case HTTP_EVENT_ON_FINISH:
-        (user_data->current_size) = in_items = brace_count = 0;
+        (user_data->current_size) = in_items = brace_count = too_long = 0;
         break;
     case HTTP_EVENT_DISCONNECTED:
-        (user_data->current_size) = in_items = brace_count = 0;
+        (user_data->current_size) = in_items = brace_count = too_long = 0;
         break;
     default:
         break;
@@ -273,32 +299,3 @@ esp_err_t playlist_http_event_cb(esp_http_client_event_t *evt)
 }
 
 /* Private functions ---------------------------------------------------------*/
-size_t static inline memcpy_trimmed(char *dest, int dest_size, const char *src, size_t src_len)
-{
-    size_t chars_stored = 0;
-    for (size_t i = 0; i < src_len; i++)
-    {
-        // Skip unnecessary spaces
-        if (isspace((unsigned char)src[i]))
-        {
-            char prev = i ? src[i - 1] : 0;
-            char next = (i < src_len - 1) ? src[i + 1] : 0;
-            if (prev == ',' && next == '\"')
-                continue;
-            if (prev == ':' && chars_stored > 1)
-            {
-                if (dest[chars_stored - 2] == '\"')
-                    continue;
-            }
-            if (strchr(" \"[]{}", prev) || strchr(" \"[]{}", next))
-                continue;
-        }
-        if ((int)chars_stored > dest_size - 1)
-        {
-            ESP_LOGE(TAG, "Buffer overflow, stoping writing!");
-            return chars_stored;
-        }
-        dest[chars_stored++] = src[i];
-    }
-    return chars_stored;
-}
\ No newline at end of file
@@ -0,0 +1,436 @@
+/* Parsing cost of the captured Spotify payloads (json_parser/test/payloads),
+ * measured on the host in three stages:
+ *  - parse:   json_parse_start() of the payload as received
+ *  - stream:  json_http_event_cb() fed with HTTP_CHUNK byte chunks, i.e. the
+ *             whitespace trimming copy into the response buffer, tokenized
+ *             on the way
+ *  - trimmed: what that replaced, memcpy_trimmed() of each chunk into the
+ *             buffer then json_parse_start() of the whole of it
+ *  - extract: what spotify_client does with the payload, from its bytes to
+ *             the TrackInfo, the lists or the connection id
+ * Dealer player states also get "same", the check that ends most of them.
+ * /me/player states get "linear" and "indexed": parse_track()'s lookups on
+ * the parsed payload, without then with json_parser's key index (which
+ * parse_objects.c doesn't use, being slower on them).
+ *
+ * tokens/s is the payload's token count (from parse) over the time taken,
+ * so stages compare on the same scale. The heap peak is the most a stage has
+ * allocated at once, the API worker's pool aside (printed once, it's kept). */
+#include <ctype.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "handler_callbacks.h"
+#include "json_parser.h"
+#include "parse_objects.h"
+#include "esp_log.h"
+#include "spotify_client_priv.h"
+
+#define MIN_BYTES (32 * 1024 * 1024)
+#define HTTP_CHUNK 512  /* esp_http_client's default rx buffer */
+
+typedef enum {
+    KIND_OTHER,
+    KIND_PLAYER,        /* /me/player */
+    KIND_DEVICES,       /* /me/player/devices */
+    KIND_PLAYLISTS,     /* a /me/playlists page */
+    KIND_DEALER,        /* PLAYER_STATE_CHANGED or DEVICE_STATE_CHANGED */
+    KIND_HELLO,         /* the dealer's first message */
+} payload_kind_t;
+
+typedef struct {
+    const char *js;
+    int len;
+    payload_kind_t kind;
+    evt_user_data_t user_data;
+    TrackInfo track;
+    List list;
+    jparse_ctx_t parsed; /* of KIND_PLAYER, for the lookups */
+    json_key_index_t index;
+} payload_t;
+
+typedef int (*stage_fn_t)(payload_t *p);
+
+/* Everything allocated goes through these, glibc's own functions included */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static size_t heap_used, heap_peak;
+
+static void *track_alloc(void *ptr)
+{
+    if (ptr) {
+        heap_used += malloc_usable_size(ptr);
+        if (heap_used > heap_peak) {
+            heap_peak = heap_used;
+        }
+    }
+    return ptr;
+}
+
+void *malloc(size_t size)
+{
+    return track_alloc(__libc_malloc(size));
+}
+
+void *calloc(size_t n, size_t size)
+{
+    return track_alloc(__libc_calloc(n, size));
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    size_t old = ptr ? malloc_usable_size(ptr) : 0;
+    void *p = __libc_realloc(ptr, size);
+    if (p || size == 0) {
+        heap_used -= old;
+    }
+    return track_alloc(p);
+}
+
+void free(void *ptr)
+{
+    if (ptr) {
+        heap_used -= malloc_usable_size(ptr);
+        __libc_free(ptr);
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* spotify_client.c isn't built here, this is its spotify_clear_track() */
+void spotify_clear_track(TrackInfo *track)
+{
+    free(track->name);
+    free(track->album.name);
+    free(track->album.url_cover);
+    spotify_free_nodes(&track->artists);
+    memset(track, 0, sizeof(*track));
+    track->artists.type = STRING_LIST;
+}
+
+/* The chunks esp_http_client would hand to the event handler */
+static void http_receive(payload_t *p, http_event_handle_cb cb)
+{
+    esp_http_client_event_t evt = {
+        .event_id = HTTP_EVENT_HEADERS_SENT,
+        .user_data = &p->user_data,
+    };
+    cb(&evt);
+    evt.event_id = HTTP_EVENT_ON_DATA;
+    for (int off = 0; off < p->len; off += HTTP_CHUNK) {
+        evt.data = (void *) (p->js + off);
+        evt.data_len = p->len - off < HTTP_CHUNK ? p->len - off : HTTP_CHUNK;
+        cb(&evt);
+    }
+    evt.event_id = HTTP_EVENT_ON_FINISH;
+    evt.data = NULL;
+    evt.data_len = 0;
+    cb(&evt);
+}
+
+static int stage_parse(payload_t *p)
+{
+    jparse_ctx_t jctx;
+    if (json_parse_start(&jctx, p->js, p->len) != OS_SUCCESS) {
+        return -1;
+    }
+    int num_tokens = jctx.num_tokens;
+    json_parse_end(&jctx);
+    return num_tokens;
+}
+
+static int stage_stream(payload_t *p)
+{
+    jparse_ctx_t *jctx = &p->user_data.jctx;
+    http_receive(p, json_http_event_cb);
+    int ret = json_parse_stream_finish(jctx) == OS_SUCCESS ? jctx->num_tokens : -1;
+    parse_json_end(jctx);
+    return ret;
+}
+
+/* handler_callbacks.c's copy of the chunks before json_http_event_cb()
+ * tokenized them, as it was */
+static const char *TAG = "BENCH";
+
+static size_t memcpy_trimmed(char *dest, int dest_size, const char *src, size_t src_len)
+{
+    size_t chars_stored = 0;
+    for (size_t i = 0; i < src_len; i++) {
+        // Skip unnecessary spaces
+        if (isspace((unsigned char) src[i])) {
+            char prev = i ? src[i - 1] : 0;
+            char next = (i < src_len - 1) ? src[i + 1] : 0;
+            if (prev == ',' && next == '\"') {
+                continue;
+            }
+            if (prev == ':' && chars_stored > 1) {
+                if (dest[chars_stored - 2] == '\"') {
+                    continue;
+                }
+            }
+            if (strchr(" \"[]{}", prev) || strchr(" \"[]{}", next)) {
+                continue;
+            }
+        }
+        if ((int) chars_stored > dest_size - 1) {
+            ESP_LOGE(TAG, "Buffer overflow, stoping writing!");
+            return chars_stored;
+        }
+        dest[chars_stored++] = src[i];
+    }
+    return chars_stored;
+}
+
+static int stage_trimmed(payload_t *p)
+{
+    char *buffer = (char *) p->user_data.buffer;
+    int buffer_size = p->user_data.buffer_size;
+    int output_len = 0;
+    for (int off = 0; off < p->len; off += HTTP_CHUNK) {
+        int len = p->len - off < HTTP_CHUNK ? p->len - off : HTTP_CHUNK;
+        output_len += memcpy_trimmed(buffer + output_len, buffer_size - output_len, p->js + off, len);
+    }
+    buffer[output_len] = 0;
+    jparse_ctx_t jctx;
+    if (json_parse_start(&jctx, buffer, output_len) != OS_SUCCESS) {
+        return -1;
+    }
+    int num_tokens = jctx.num_tokens;
+    json_parse_end(&jctx);
+    return num_tokens;
+}
+
+static int stage_extract(payload_t *p)
+{
+    jparse_ctx_t jctx, *stream = &p->user_data.jctx;
+    TrackInfo *track = &p->track;
+    SpotifyEvent_t evt = { .type = PARSE_ERROR };
+    char *conn_id = NULL;
+    int ret = -1;
+
+    switch (p->kind) {
+    case KIND_PLAYER:
+        spotify_clear_track(track);
+        http_receive(p, json_http_event_cb);
+        if (json_parse_stream_finish(stream) == OS_SUCCESS) {
+            evt = parse_track(stream, &track, 1);
+        }
+        parse_json_end(stream);
+        return evt.type == NEW_TRACK ? 1 : -1; /* episodes come without artists */
+    case KIND_DEVICES:
+        spotify_free_nodes(&p->list);
+        http_receive(p, json_http_event_cb);
+        if (json_parse_stream_finish(stream) == OS_SUCCESS) {
+            ret = parse_available_devices(stream, &p->list) == ESP_OK ? (int) p->list.count : -1;
+        }
+        parse_json_end(stream);
+        return ret;
+    case KIND_PLAYLISTS:
+        spotify_free_nodes(&p->list);
+        http_receive(p, playlist_http_event_cb);
+        return p->list.count ? (int) p->list.count : -1;
+    case KIND_DEALER:
+        /* a new track each time, as spotify_client's websocket branch sees it */
+        spotify_clear_track(track);
+        if (parse_same_track(p->js, track)) {
+            return -1;
+        }
+        if (parse_track_start(&jctx, p->js) == ESP_OK) {
+            evt = parse_track(&jctx, &track, 0);
+        }
+        parse_json_end(&jctx);
+        return evt.type == NEW_TRACK || evt.type == DEVICE_STATE_CHANGED ? 1 : -1;
+    case KIND_HELLO:
+        if (parse_json_start(&jctx, p->js) == ESP_OK) {
+            ret = parse_connection_id(&jctx, &conn_id) == ESP_OK ? (int) strlen(conn_id) : -1;
+            parse_json_end(&jctx);
+        }
+        free(conn_id);
+        return ret;
+    default:
+        return 0;
+    }
+}
+
+static int stage_same(payload_t *p)
+{
+    return parse_same_track(p->js, &p->track) ? 1 : -1;
+}
+
+/* The lookups parse_track() does on a player state, the number found */
+static int player_lookups(jparse_ctx_t *jctx)
+{
+    char str[128];
+    int64_t int64_val;
+    bool bool_val;
+    int num_elem, int_val;
+    json_iter_t it;
+    int found = 0;
+
+    jctx->cur = jctx->tokens;
+    if (json_obj_get_object(jctx, "item") != OS_SUCCESS) {
+        return 0;
+    }
+    found += json_obj_get_string(jctx, "id", str, sizeof(str)) == OS_SUCCESS;
+    found += json_obj_get_string(jctx, "name", str, sizeof(str)) == OS_SUCCESS;
+    found += json_obj_get_int64(jctx, "duration_ms", &int64_val) == OS_SUCCESS;
+    if (json_obj_get_array(jctx, "artists", &num_elem) == OS_SUCCESS) {
+        json_arr_iter_begin(jctx, &it);
+        while (json_arr_iter_next(jctx, &it) == OS_SUCCESS) {
+            found += json_obj_get_string(jctx, "name", str, sizeof(str)) == OS_SUCCESS;
+        }
+        json_obj_leave_array(jctx);
+    }
+    if (json_obj_get_object(jctx, "album") == OS_SUCCESS) {
+        found += json_obj_get_string(jctx, "name", str, sizeof(str)) == OS_SUCCESS;
+        json_obj_leave_object(jctx);
+    }
+    json_obj_leave_object(jctx);
+    found += json_obj_get_int64(jctx, "progress_ms", &int64_val) == OS_SUCCESS;
+    found += json_obj_get_bool(jctx, "is_playing", &bool_val) == OS_SUCCESS;
+    found += json_obj_get_int(jctx, "timestamp", &int_val) == OS_SUCCESS;
+    return found;
+}
+
+static int stage_linear(payload_t *p)
+{
+    json_parse_set_key_index(&p->parsed, NULL);
+    return player_lookups(&p->parsed);
+}
+
+/* The index is built anew, as it is for each parse */
+static int stage_indexed(payload_t *p)
+{
+    json_parse_set_key_index(&p->parsed, &p->index);
+    return player_lookups(&p->parsed);
+}
+
+/* Returns the stage's result on the payload, after printing its numbers */
+static int bench(const char *name, stage_fn_t stage, payload_t *p, int num_tokens)
+{
+    size_t heap_before = heap_used;
+    heap_peak = heap_used;
+    int ret = stage(p);
+    size_t peak = heap_peak - heap_before;
+    if (ret < 0) {
+        fprintf(stderr, "  %s failed\n", name);
+        return ret;
+    }
+
+    int iterations = MIN_BYTES / p->len + 1;
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        stage(p);
+    }
+    double ns = (double) (now_ns() - t0) / iterations;
+    printf("  %-8s %9.2f us %8.2f Mtok/s %8.1f MB/s %8zu B heap\n", name, ns / 1000,
+           num_tokens / ns * 1000, p->len / ns * 1000, peak);
+    return ret;
+}
+
+static payload_kind_t payload_kind(const char *path)
+{
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    if (strncmp(name, "player_", 7) == 0) {
+        return KIND_PLAYER;
+    } else if (strncmp(name, "devices", 7) == 0) {
+        return KIND_DEVICES;
+    } else if (strncmp(name, "playlists", 9) == 0) {
+        return KIND_PLAYLISTS;
+    } else if (strncmp(name, "dealer_hello", 12) == 0) {
+        return KIND_HELLO;
+    } else if (strncmp(name, "dealer_", 7) == 0) {
+        return KIND_DEALER;
+    }
+    return KIND_OTHER;
+}
+
+static char *read_file(const char *path, int *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    rewind(f);
+    char *js = malloc(*len + 1);
+    if (js && fread(js, 1, *len, f) != (size_t) *len) {
+        free(js);
+        js = NULL;
+    }
+    fclose(f);
+    if (js) {
+        js[*len] = 0;
+    }
+    return js;
+}
+
+int main(int argc, char **argv)
+{
+    size_t heap_before = heap_used;
+    parse_objects_init();
+    // parses as the API worker does
+    parse_objects_attach(CONFIG_SPOTIFY_CLIENT_TASK_TOKENS);
+    printf("task pool: %zu B\n", heap_used - heap_before);
+
+    int failed = 0;
+    for (int i = 1; i < argc; i++) {
+        payload_t p = { .kind = payload_kind(argv[i]) };
+        p.track.artists.type = STRING_LIST;
+        p.list.type = p.kind == KIND_PLAYLISTS ? PLAYLIST_LIST : DEVICE_LIST;
+        char *js = read_file(argv[i], &p.len);
+        if (!js) {
+            return 1;
+        }
+        p.js = js;
+        /* the buffer always fits, the device's limits aren't measured here */
+        p.user_data.buffer_size = p.len + 1;
+        p.user_data.buffer = malloc(p.user_data.buffer_size);
+        p.user_data.ctx = &p.list; /* where playlist_http_event_cb() puts them */
+
+        int num_tokens = stage_parse(&p);
+        printf("%s: %d bytes, %d tokens\n", argv[i], p.len, num_tokens);
+        if (num_tokens <= 0 || !p.user_data.buffer) {
+            failed = 1;
+            free(p.user_data.buffer);
+            free(js);
+            continue;
+        }
+        failed |= bench("parse", stage_parse, &p, num_tokens) < 0;
+        failed |= bench("stream", stage_stream, &p, num_tokens) < 0;
+        failed |= bench("trimmed", stage_trimmed, &p, num_tokens) < 0;
+        if (p.kind != KIND_OTHER) {
+            failed |= bench("extract", stage_extract, &p, num_tokens) < 0;
+        }
+        if (p.kind == KIND_DEALER && p.track.id[0]) {
+            failed |= bench("same", stage_same, &p, num_tokens) < 0;
+        }
+        if (p.kind == KIND_PLAYER) {
+            if (json_parse_start(&p.parsed, p.js, p.len) == OS_SUCCESS) {
+                failed |= bench("linear", stage_linear, &p, num_tokens) <= 0;
+                failed |= bench("indexed", stage_indexed, &p, num_tokens) <= 0;
+                json_parse_end(&p.parsed);
+            } else {
+                failed = 1;
+            }
+        }
+        spotify_clear_track(&p.track);
+        spotify_free_nodes(&p.list);
+        free(p.user_data.buffer);
+        free(js);
+    }
+    return failed;
+}
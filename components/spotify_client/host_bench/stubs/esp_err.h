@@ -0,0 +1,27 @@
+/* Host stand-ins of the ESP-IDF declarations spotify_client's parsing code
+ * uses, just enough to build it for host_bench. */
+#pragma once
+#include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> /* what ESP-IDF's headers bring along */
+
+typedef int esp_err_t;
+
+#define ESP_OK                   0
+#define ESP_FAIL                 -1
+#define ESP_ERR_NO_MEM           0x101
+#define ESP_ERR_NOT_FOUND        0x105
+#define ESP_ERR_INVALID_RESPONSE 0x108
+
+const char *esp_err_to_name(esp_err_t code);
+
+#define ESP_ERROR_CHECK(x) do {                                             \
+        esp_err_t err_rc_ = (x);                                            \
+        if (err_rc_ != ESP_OK) {                                            \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #x);  \
+            abort();                                                        \
+        }                                                                   \
+    } while (0)
@@ -0,0 +1,4 @@
+#pragma once
+#include "esp_err.h"
+
+typedef const char *esp_event_base_t;
@@ -0,0 +1,23 @@
+#pragma once
+#include <stdbool.h>
+#include "esp_event.h"
+
+typedef struct esp_websocket_client *esp_websocket_client_handle_t;
+
+typedef enum {
+    WEBSOCKET_EVENT_ERROR = 0,
+    WEBSOCKET_EVENT_CONNECTED,
+    WEBSOCKET_EVENT_DISCONNECTED,
+    WEBSOCKET_EVENT_DATA,
+    WEBSOCKET_EVENT_CLOSED,
+} esp_websocket_event_id_t;
+
+typedef struct {
+    const char *data_ptr;
+    int data_len;
+    uint8_t op_code;
+    esp_websocket_client_handle_t client;
+    void *user_context;
+    int payload_len;
+    int payload_offset;
+} esp_websocket_event_data_t;
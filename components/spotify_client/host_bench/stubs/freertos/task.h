@@ -0,0 +1,5 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+char *pcTaskGetName(TaskHandle_t task);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
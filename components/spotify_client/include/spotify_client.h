@@ -8,6 +8,7 @@
 /* Exported types ------------------------------------------------------------*/
 
 typedef struct esp_spotify_client *esp_spotify_client_handle_t;
+typedef struct spotify_request *spotify_request_handle_t;
 
 typedef enum {
     SAME_TRACK,
@@ -20,6 +21,8 @@ typedef enum {
     TRANSFERRED_OK,
     TRANSFERRED_FAIL,
     NO_PLAYER_ACTIVE,
+    PARSE_ERROR, // the message couldn't be read, see err and field
+    PLAYER_ERROR, // the player couldn't start or confirm its session, see err; it's retried
     UNKNOW
 } Event_t;
 
@@ -61,19 +64,87 @@ typedef struct
     Device device;
 } TrackInfo;
 
+// what spotify_play() starts, unset fields are left to Spotify
 typedef struct {
-    Event_t type;
-    void*   payload;
+    const char*        context_uri; // album, artist or playlist
+    const char* const* uris;        // tracks to play, without a context
+    int                num_uris;
+    int                offset;      // of the first track in the context or uris
+    int                position_ms; // in the first track
+} PlayOptions_t;
+
+// connections are kept open between requests, one to each host: the API,
+// the token endpoint and the covers CDN. Counted over them all, with the
+// second connection to the API that bulk transfers are made on
+typedef struct {
+    uint32_t requests;   // sent, retries included
+    uint32_t connects;   // connections opened, the other requests reused one
+    uint32_t reconnects; // requests sent again because the kept connection was closed by the server
+    uint32_t full_handshakes;    // connections opened without a TLS session to offer
+    uint32_t session_offers;     // connections opened offering the host's saved TLS session, see
+                                 // SPOTIFY_CLIENT_TLS_RESUMPTION: an upper bound of the resumed ones,
+                                 // the server may still do a full handshake
+    uint32_t retries;            // attempts after a failed or rate limited one
+    uint32_t rate_limited;       // 429 and 503 responses
+    uint32_t breaker_trips;      // times a host was left alone, failing or asking to wait
+    uint32_t fast_failures;      // requests failed without being sent, their host left alone
+} SpotifyConnStats_t;
+
+typedef struct {
+    Event_t     type;
+    void*       payload;
+    esp_err_t   err;   // why PARSE_ERROR, or why the payload is partial (fields left empty)
+    const char* field; // path of the first field err is about, NULL if none
 } SpotifyEvent_t;
 
+// what an asynchronous request got
+typedef struct {
+    esp_err_t       err;
+    HttpStatus_Code status_code; // of spotify_play_context_uri_async(), 0 if no response came
+    List*           list;        // playlists or devices, the caller's to free, NULL on error
+    ssize_t         data_read;   // of fetch_album_art_async(), ESP_FAIL on error
+} SpotifyResult_t;
+
+// Called on the client's task once an asynchronous request completes: it
+// mustn't block, nor call the client's blocking functions. The request is
+// freed when it returns
+typedef void (*spotify_request_cb_t)(spotify_request_handle_t req, const SpotifyResult_t* result, void* user_ctx);
+
 /* Exported functions prototypes ---------------------------------------------*/
 esp_spotify_client_handle_t  spotify_client_init(UBaseType_t priority);
 esp_err_t  spotify_client_deinit(esp_spotify_client_handle_t client);
 esp_err_t  player_dispatch_event(esp_spotify_client_handle_t client, SendEvent_t event);
 BaseType_t spotify_wait_event(esp_spotify_client_handle_t client, SpotifyEvent_t* event, TickType_t xTicksToWait);
+esp_err_t  spotify_play(esp_spotify_client_handle_t client, const PlayOptions_t* options, HttpStatus_Code* status_code);
 esp_err_t  spotify_play_context_uri(esp_spotify_client_handle_t client, const char* uri, HttpStatus_Code* status_code);
+esp_err_t  spotify_transfer_playback(esp_spotify_client_handle_t client, const char* const* device_ids, int num_ids, bool play, HttpStatus_Code* status_code);
+esp_err_t  spotify_save_tracks(esp_spotify_client_handle_t client, const char* const* ids, int num_ids, HttpStatus_Code* status_code);
+esp_err_t  spotify_remove_saved_tracks(esp_spotify_client_handle_t client, const char* const* ids, int num_ids, HttpStatus_Code* status_code);
 List*      spotify_user_playlists(esp_spotify_client_handle_t client);
 List*      spotify_available_devices(esp_spotify_client_handle_t client);
 void       spotify_clear_track(TrackInfo* track);
 esp_err_t  spotify_clone_track(TrackInfo* dest, const TrackInfo* src);
 ssize_t    fetch_album_art(esp_spotify_client_handle_t client, TrackInfo *track, uint8_t *out_buf, size_t buf_size);
+void       spotify_conn_stats(esp_spotify_client_handle_t client, SpotifyConnStats_t* stats);
+
+// Deadline of the requests of the blocking functions above, from their call,
+// portMAX_DELAY (the default) for none. Past it a request fails with
+// ESP_ERR_TIMEOUT, its transfer aborted
+void       spotify_set_request_timeout(esp_spotify_client_handle_t client, TickType_t timeout);
+
+/* Asynchronous versions of the above, they return once the request is queued,
+ * NULL if it couldn't be. The timeout is the request's deadline, as with
+ * spotify_set_request_timeout(). Without a callback the calling task gets a
+ * task notification (xTaskNotifyGive()) once it completes, the result is read
+ * with spotify_request_wait() and the request freed with
+ * spotify_request_free() */
+spotify_request_handle_t spotify_user_playlists_async(esp_spotify_client_handle_t client, TickType_t timeout, spotify_request_cb_t cb, void* user_ctx);
+spotify_request_handle_t spotify_available_devices_async(esp_spotify_client_handle_t client, TickType_t timeout, spotify_request_cb_t cb, void* user_ctx);
+spotify_request_handle_t spotify_play_context_uri_async(esp_spotify_client_handle_t client, const char* uri, TickType_t timeout, spotify_request_cb_t cb, void* user_ctx);
+spotify_request_handle_t fetch_album_art_async(esp_spotify_client_handle_t client, TrackInfo* track, uint8_t* out_buf, size_t buf_size, TickType_t timeout, spotify_request_cb_t cb, void* user_ctx);
+bool       spotify_request_wait(spotify_request_handle_t req, SpotifyResult_t* result, TickType_t xTicksToWait);
+void       spotify_request_free(spotify_request_handle_t req);
+// Aborts a request not complete yet, queued or in transfer: it completes with
+// ESP_ERR_INVALID_STATE as soon as the worker sees it, the connection closed.
+// ESP_ERR_NOT_FOUND if it had completed already
+esp_err_t  spotify_request_cancel(esp_spotify_client_handle_t client, spotify_request_handle_t req);
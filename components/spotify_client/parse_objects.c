@@ -1,211 +1,941 @@
 /* Includes ------------------------------------------------------------------*/
 #include "parse_objects.h"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "json_parser.h"
 #include "spotify_client_priv.h"
 #include <stdlib.h>
 #include <string.h>
 
 /* Private macro -------------------------------------------------------------*/
-#define MAX_TOKENS 1000
+// tasks parsing with a pool of their own, the client has three
+#define MAX_POOLS 8
+// longest string value kept from a response (must fit an access token), the
+// rest, e.g. long episode descriptions, is dropped while streaming
+#define MAX_STRLEN 512
 
-// early check of unrecoverable error
+// early check of unrecoverable error, i.e. a bug: what comes from Spotify is
+// never checked with it
 #define ERR_CHECK(x) ESP_ERROR_CHECK(x)
 
+#define NUM_FIELDS(fields) (sizeof(fields) / sizeof(fields[0]))
+#define ALL_FIELDS(fields) ((1u << NUM_FIELDS(fields)) - 1)
+
+// where the player state is inside a dealer message
+#define PLAYER_EVENT_ROOT "payloads[].events[]"
+#define EVENT_TYPE        "type"        // from the event
+#define EVENT_STATE_PATH  "event.state" // from the event
+#define PLAYER_STATE_ROOT PLAYER_EVENT_ROOT "." EVENT_STATE_PATH
+// arrays of the player state, read element by element
+#define ARTISTS_PATH "item.artists"
+#define IMAGES_PATH  "item.album.images"
+#define DEVICES_PATH "devices"
+#define COVER_HEIGHT 300 // of the album image kept
+
 /* Private types -------------------------------------------------------------*/
+/* What the parses of a task work with, see parse_objects_attach(). Tasks
+ * parse at the same time without locks */
+typedef struct {
+#ifdef CONFIG_SPOTIFY_CLIENT_SAX_PARSER
+    json_sax_t stream_sax; // only checks that a streamed response is complete
+#else
+    json_tok_arena_t arena; // bigger messages take their tokens from the heap
+    json_tok_t       tokens[];
+#endif
+} ParsePool_t;
+
+// what parse_track() reads from a player state, in the order of state_fields
+typedef struct {
+    json_str_t id;
+    json_str_t name;
+    int64_t    duration_ms;
+    json_str_t album_name;
+    int64_t    progress_ms;
+    bool       is_playing;
+} PlayerState_t;
+
+typedef struct {
+    json_str_t name;
+} Artist_t;
+
+typedef struct {
+    json_str_t url;
+    int        height;
+} Image_t;
+
+// all parse_track() reads from a message, either parser fills it in and
+// track_event() tells what it is. Views are raw, str NULL until found
+typedef struct {
+    json_str_t    type; // of a dealer event
+    bool          has_state;
+    PlayerState_t state;
+    uint32_t      found; // fields of state
+    bool          has_artists;
+    List          artists; // decoded names
+    bool          has_images;
+    json_str_t    cover;       // url of the COVER_HEIGHT image
+    esp_err_t     artists_err; // of the first artist that couldn't be read
+    bool          cover_no_url;
+} TrackRead_t;
+
+// what parse_available_devices() reads, either parser fills it in
+typedef struct {
+    List*     devices_list;
+    bool      has_devices;
+    esp_err_t err; // first device left out
+} DevicesRead_t;
+
+#ifdef CONFIG_SPOTIFY_CLIENT_SAX_PARSER
+typedef struct {
+    DevicesRead_t* read;
+    DeviceItem_t*  item; // added to the list once complete
+    int            item_depth; // -1 outside of a device
+    uint32_t       found;      // fields of item
+} DevicesCtx_t;
+
+// parse_track() in a single scan: the event type comes after the player
+// state, the track id after the artists, so all is kept until the end
+typedef struct {
+    TrackRead_t* read;
+    bool         wrapped;     // in a dealer event, whose type is wanted
+    int          event_depth; // of the first event, -1 until found
+    int          root_depth;  // of the player state, -1 outside of it
+    bool         state_done;
+    int          elem_depth; // of the artist or image scanned, -1 outside
+    bool         is_artist;
+    uint32_t     elem_found;
+    Artist_t     artist;
+    Image_t      image;
+} TrackCtx_t;
+#else
+enum {
+    PATH_EVENT, // of a dealer message
+    PATH_STATE, // from the event
+    // from the player state, found together
+    PATH_ARTISTS,
+    PATH_IMAGES,
+    NUM_PATHS,
+};
+#endif
+#define EVENT_STATE "payloads[0].events[0].event.state."
+
+// checked in the raw message by parse_same_track()
+enum {
+    RAW_TYPE,
+    RAW_TRACK_ID,
+    RAW_PROGRESS,
+    RAW_IS_PLAYING,
+    NUM_RAW_PATHS,
+};
 
 /* Private function prototypes -----------------------------------------------*/
+static int extract(jparse_ctx_t* jctx, const json_field_t* fields, int num_fields, void* dest, uint32_t* found);
+static int read_devices(jparse_ctx_t* jctx, DevicesRead_t* read);
+static int read_track(jparse_ctx_t* jctx, TrackRead_t* read, bool wrapped);
+#ifdef CONFIG_SPOTIFY_CLIENT_SAX_PARSER
+static int devices_cb(json_sax_t* sax, const json_sax_evt_t* evt, void* arg);
+static int track_cb(json_sax_t* sax, const json_sax_evt_t* evt, void* arg);
+#else
+static void read_state(jparse_ctx_t* jctx, TrackRead_t* read);
+static void compile_paths(void);
+#endif
+static SpotifyEvent_t track_event(TrackRead_t* read, bool wrapped, TrackInfo* track, const char* js);
+static void           add_device(DevicesRead_t* read, DeviceItem_t* item, uint32_t found);
+static void           add_artist(TrackRead_t* read, const Artist_t* artist, uint32_t found);
+static void           add_image(TrackRead_t* read, const Image_t* image, uint32_t found);
+static SpotifyEvent_t parse_error(esp_err_t err, const char* field, const char* js);
+static void           set_partial(SpotifyEvent_t* evt, esp_err_t err, const char* field);
+static const char*    missing_field(const json_field_t* fields, uint32_t found);
+static void           free_device(DeviceItem_t* item);
+static bool           strview_equals(const json_str_t* view, const char* str);
+static char*          dup_view(const json_str_t* view);
+static bool           other_event(SpotifyEvent_t* evt, const json_str_t* type, const char* js);
+static ParsePool_t*   task_pool(void);
 
 /* Locally scoped variables --------------------------------------------------*/
 static const char* TAG = "PARSE_OBJECT";
-static json_tok_t  tokens[MAX_TOKENS];
+#ifndef CONFIG_SPOTIFY_CLIENT_SAX_PARSER
+static const char* const path_strs[NUM_PATHS] = {
+    [PATH_EVENT] = "payloads[0].events[0]",
+    [PATH_STATE] = EVENT_STATE_PATH,
+    [PATH_ARTISTS] = ARTISTS_PATH,
+    [PATH_IMAGES] = IMAGES_PATH,
+};
+static json_path_t paths[NUM_PATHS]; // compiled by parse_objects_init()
+// all parse_track() reads from a dealer message, the rest isn't tokenized
+static const char* const event_query_strs[] = {
+    "payloads[0].events[0]." EVENT_TYPE,
+    EVENT_STATE "item.id",
+    EVENT_STATE "item.name",
+    EVENT_STATE "item.duration_ms",
+    EVENT_STATE "item.album.name",
+    EVENT_STATE IMAGES_PATH,
+    EVENT_STATE ARTISTS_PATH,
+    EVENT_STATE "progress_ms",
+    EVENT_STATE "is_playing",
+};
+static json_path_t event_query[NUM_FIELDS(event_query_strs)];
+#endif
+static const char* const raw_path_strs[NUM_RAW_PATHS] = {
+    [RAW_TYPE] = "payloads[0].events[0]." EVENT_TYPE,
+    [RAW_TRACK_ID] = EVENT_STATE "item.id",
+    [RAW_PROGRESS] = EVENT_STATE "progress_ms",
+    [RAW_IS_PLAYING] = EVENT_STATE "is_playing",
+};
+static json_path_t raw_paths[NUM_RAW_PATHS]; // compiled by parse_objects_init()
+// pools[i] is the pool of pool_tasks[i], NULL if the slot is free
+static TaskHandle_t pool_tasks[MAX_POOLS];
+static ParsePool_t* pools[MAX_POOLS];
+static portMUX_TYPE pools_lock = portMUX_INITIALIZER_UNLOCKED;
+#ifndef CONFIG_SPOTIFY_CLIENT_SAX_PARSER
+// for the tasks without a pool: empty, each parse takes its tokens from the
+// heap, it's never written
+static json_tok_t       no_tokens[1];
+static json_tok_arena_t heap_arena = { .tokens = no_tokens };
+#endif
+
+// The fields read by both parsers, and so the paths their errors name. Arrays
+// are walked by each parser, element fields are relative to the element
+static const json_field_t event_fields[] = {
+    JSON_FIELD(EVENT_TYPE, JSON_FIELD_STR_VIEW, TrackRead_t, type),
+};
+// relative to the player state
+static const json_field_t state_fields[] = {
+    JSON_FIELD("item.id", JSON_FIELD_STR_VIEW, PlayerState_t, id),
+    JSON_FIELD("item.name", JSON_FIELD_STR_VIEW, PlayerState_t, name),
+    JSON_FIELD("item.duration_ms", JSON_FIELD_INT64, PlayerState_t, duration_ms),
+    JSON_FIELD("item.album.name", JSON_FIELD_STR_VIEW, PlayerState_t, album_name),
+    JSON_FIELD("progress_ms", JSON_FIELD_INT64, PlayerState_t, progress_ms),
+    JSON_FIELD("is_playing", JSON_FIELD_BOOL, PlayerState_t, is_playing),
+};
+// what can change while the same track is playing
+#define STATE_PLAYBACK_FIELDS 4 // index of the first of them
+static const json_field_t artist_fields[] = {
+    JSON_FIELD("name", JSON_FIELD_STR_VIEW, Artist_t, name),
+};
+static const json_field_t image_fields[] = {
+    JSON_FIELD("url", JSON_FIELD_STR_VIEW, Image_t, url),
+    JSON_FIELD("height", JSON_FIELD_INT, Image_t, height),
+};
+static const json_field_t device_fields[] = {
+    JSON_FIELD("name", JSON_FIELD_DUP_STRING, DeviceItem_t, name),
+    JSON_FIELD("id", JSON_FIELD_DUP_STRING, DeviceItem_t, id),
+};
+static const json_field_t playlist_fields[] = {
+    JSON_FIELD("name", JSON_FIELD_DUP_STRING, PlaylistItem_t, name),
+    JSON_FIELD("uri", JSON_FIELD_DUP_STRING, PlaylistItem_t, uri),
+};
+static const json_field_t connection_id_field[] = {
+    { "headers.Spotify-Connection-Id", JSON_FIELD_DUP_STRING, 0, sizeof(char*) },
+};
+#ifdef CONFIG_SPOTIFY_CLIENT_SAX_PARSER
+// containers of the player state that are scanned, the others are skipped
+static const char* const state_containers[] = {
+    "item", ARTISTS_PATH, ARTISTS_PATH "[]", "item.album", IMAGES_PATH, IMAGES_PATH "[]",
+};
+#endif
 
 /* Globally scoped variables definitions -------------------------------------*/
 
 /* Exported functions --------------------------------------------------------*/
-void parse_access_token(const char* js, char* access_token, int size)
+
+/* Paths are compiled once, before any task parses */
+void parse_objects_init(void)
 {
-    jparse_ctx_t jctx;
-    ERR_CHECK(json_parse_start_static(&jctx, js, strlen(js), tokens, MAX_TOKENS));
-    ERR_CHECK(json_obj_get_string(&jctx, "access_token", access_token, size));
-    json_parse_end_static(&jctx);
+    for (int i = 0; i < NUM_RAW_PATHS; i++) {
+        ERR_CHECK(json_path_compile(&raw_paths[i], raw_path_strs[i]));
+    }
+#ifndef CONFIG_SPOTIFY_CLIENT_SAX_PARSER
+    compile_paths();
+#endif
 }
 
-void parse_available_devices(const char* js, List* devices_list)
+/* Gives the calling task a pool of num_tokens tokens (unused by the SAX
+ * parsers), until parse_objects_detach(). Tasks without one parse with
+ * tokens from the heap, as many as each message needs */
+esp_err_t parse_objects_attach(int num_tokens)
 {
-    jparse_ctx_t jctx;
-    ERR_CHECK(json_parse_start_static(&jctx, js, strlen(js), tokens, MAX_TOKENS));
-    int num_elem;
-    ERR_CHECK(json_obj_get_array(&jctx, "devices", &num_elem));
-    for (int i = 0; i < num_elem; i++) {
-        json_arr_get_object(&jctx, i);
-        DeviceItem_t* item = malloc(sizeof(*item));
-        assert(item);
-        ERR_CHECK(json_obj_dup_string(&jctx, "name", &item->name));
-        ERR_CHECK(json_obj_dup_string(&jctx, "id", &item->id));
-        assert(spotify_append_item_to_list(devices_list, (void*)item));
-        ERR_CHECK(json_arr_leave_object(&jctx));
+#ifdef CONFIG_SPOTIFY_CLIENT_SAX_PARSER
+    ParsePool_t* pool = calloc(1, sizeof(*pool));
+#else
+    ParsePool_t* pool = (num_tokens > 0) ? calloc(1, sizeof(*pool) + num_tokens * sizeof(json_tok_t)) : NULL;
+#endif
+    if (!pool) {
+        ESP_LOGE(TAG, "Cannot allocate the parse pool of %s", pcTaskGetName(NULL));
+        return ESP_ERR_NO_MEM;
     }
-    json_parse_end_static(&jctx);
+#ifndef CONFIG_SPOTIFY_CLIENT_SAX_PARSER
+    json_tok_arena_init(&pool->arena, pool->tokens, num_tokens);
+#endif
+    int slot = -1;
+    taskENTER_CRITICAL(&pools_lock);
+    for (int i = 0; i < MAX_POOLS && slot < 0; i++) {
+        if (!pool_tasks[i]) {
+            slot = i;
+            pools[i] = pool;
+            pool_tasks[i] = xTaskGetCurrentTaskHandle();
+        }
+    }
+    taskEXIT_CRITICAL(&pools_lock);
+    if (slot < 0) {
+        ESP_LOGW(TAG, "No pool left for %s, it parses from the heap", pcTaskGetName(NULL));
+        free(pool);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
 }
 
-void parse_playlist(const char* js, PlaylistItem_t* playlist_item)
+/* Once the task is deleted, or done parsing */
+void parse_objects_detach(TaskHandle_t task)
 {
-    jparse_ctx_t jctx;
-    ERR_CHECK(json_parse_start_static(&jctx, js, strlen(js), tokens, MAX_TOKENS));
-    ERR_CHECK(json_obj_dup_string(&jctx, "name", &playlist_item->name));
-    ERR_CHECK(json_obj_dup_string(&jctx, "uri", &playlist_item->uri));
-    json_parse_end_static(&jctx);
+    ParsePool_t* pool = NULL;
+    taskENTER_CRITICAL(&pools_lock);
+    for (int i = 0; i < MAX_POOLS; i++) {
+        if (pool_tasks[i] == task) {
+            pool = pools[i];
+            pools[i] = NULL;
+            pool_tasks[i] = NULL;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&pools_lock);
+    free(pool);
 }
 
-void parse_connection_id(const char* js, char** data)
+#ifdef CONFIG_SPOTIFY_CLIENT_SAX_PARSER
+/* Without tokens the parsers scan the whole message again for each lookup,
+ * each scan ends as soon as the fields it looks for are found */
+esp_err_t parse_json_start(jparse_ctx_t* jctx, const char* js)
 {
-    jparse_ctx_t jctx;
-    ERR_CHECK(json_parse_start_static(&jctx, js, strlen(js), tokens, MAX_TOKENS));
-    ERR_CHECK(json_obj_get_object(&jctx, "headers"));
-    ERR_CHECK(json_obj_dup_string(&jctx, "Spotify-Connection-Id", data));
-    json_parse_end_static(&jctx);
+    if (json_sax_parse(js, strlen(js), NULL, NULL) != OS_SUCCESS) {
+        ESP_LOGE(TAG, "Error parsing json:\n%s", js);
+        return ESP_FAIL;
+    }
+    memset(jctx, 0, sizeof(*jctx));
+    jctx->js = js;
+    return ESP_OK;
 }
 
-SpotifyEvent_t parse_track(const char* js, TrackInfo** track, int initial_state)
+/* parse_track() scans the message itself, once, checking it on the way */
+esp_err_t parse_track_start(jparse_ctx_t* jctx, const char* js)
 {
-    // ESP_LOGW(TAG, "%s", js);
-    assert(track && *track);
+    memset(jctx, 0, sizeof(*jctx));
+    jctx->js = js;
+    return ESP_OK;
+}
 
-    SpotifyEvent_t spotify_evt = { .type = UNKNOW };
+/* One stream at a time per task with a pool, the others allocate their
+ * validator */
+esp_err_t parse_json_stream_start(jparse_ctx_t* jctx, char* buf, size_t size)
+{
+    ParsePool_t* pool = task_pool();
+    json_sax_t*  sax = pool ? &pool->stream_sax : malloc(sizeof(json_sax_t));
+    if (!sax || json_parse_stream_begin(jctx, buf, size, NULL, 0) != OS_SUCCESS) {
+        if (!pool) {
+            free(sax);
+        }
+        return ESP_FAIL;
+    }
+    json_parse_stream_set_max_strlen(jctx, MAX_STRLEN);
+    json_sax_begin(sax, NULL, NULL);
+    json_parse_stream_set_sax(jctx, sax);
+    return ESP_OK;
+}
 
-    jparse_ctx_t jctx;
-    ERR_CHECK(json_parse_start_static(&jctx, js, strlen(js), tokens, MAX_TOKENS));
+void parse_json_end(jparse_ctx_t* jctx)
+{
+    ParsePool_t* pool = task_pool();
+    if (jctx->sax && (!pool || jctx->sax != &pool->stream_sax)) {
+        free(jctx->sax);
+    }
+    json_parse_end_static(jctx);
+}
 
-    if (initial_state) {
-        // this function was called for the purpose of initial state,
-        // that is, a request via http was made, not really an event from ws
-        goto initial_state;
+#else
+/* Tokens come from the pool of the calling task, only as many as the
+ * message has. parse_json_end() must be called by the same task, in reverse
+ * order of the starts */
+esp_err_t parse_json_start(jparse_ctx_t* jctx, const char* js)
+{
+    ParsePool_t* pool = task_pool();
+    if (json_parse_start_arena(jctx, js, strlen(js), pool ? &pool->arena : &heap_arena) != OS_SUCCESS) {
+        ESP_LOGE(TAG, "Error parsing json:\n%s", js);
+        memset(jctx, 0, sizeof(*jctx));
+        return ESP_FAIL;
     }
+    return ESP_OK;
+}
 
-    int num_elem;
-    if (json_obj_get_array(&jctx, "payloads", &num_elem) != OS_SUCCESS) {
-        ESP_LOGE(TAG, "\"payloads\" array is missing:\n%s", js);
-        spotify_evt.type = UNKNOW;
-        return spotify_evt;
+/* Player events are mostly progress updates of the same track, only their
+ * few fields are tokenized and the scan stops once they are found */
+esp_err_t parse_track_start(jparse_ctx_t* jctx, const char* js)
+{
+    ParsePool_t* pool = task_pool();
+    if (json_parse_start_query(jctx, js, strlen(js), pool ? &pool->arena : &heap_arena, event_query,
+            NUM_FIELDS(event_query))
+        != OS_SUCCESS) {
+        ESP_LOGE(TAG, "Error parsing json:\n%s", js);
+        memset(jctx, 0, sizeof(*jctx));
+        return ESP_FAIL;
     }
-    if (num_elem == 0) {
-        ESP_LOGE(TAG, "\"payloads\" array is empty:\n%s", js);
-        spotify_evt.type = UNKNOW;
-        return spotify_evt;
+    return ESP_OK;
+}
+
+esp_err_t parse_json_stream_start(jparse_ctx_t* jctx, char* buf, size_t size)
+{
+    ParsePool_t* pool = task_pool();
+    if (json_parse_stream_begin_arena(jctx, buf, size, pool ? &pool->arena : &heap_arena) != OS_SUCCESS) {
+        memset(jctx, 0, sizeof(*jctx));
+        return ESP_FAIL;
     }
-    if (num_elem > 1) {
-        ESP_LOGW(TAG, "\"payloads\" array has more than a element:\n%s", js);
+    json_parse_stream_set_max_strlen(jctx, MAX_STRLEN);
+    return ESP_OK;
+}
+
+void parse_json_end(jparse_ctx_t* jctx)
+{
+    json_parse_end_arena(jctx);
+}
+
+#endif
+
+/* expires_in is 0 if the response has none */
+esp_err_t parse_access_token(jparse_ctx_t* jctx, char* access_token, int size, int* expires_in)
+{
+    const json_field_t token_field = { "access_token", JSON_FIELD_STRING, 0, size };
+    const json_field_t expiry_field = { "expires_in", JSON_FIELD_INT, 0, sizeof(int) };
+    if (extract(jctx, &token_field, 1, access_token, NULL) != OS_SUCCESS) {
+        ESP_LOGE(TAG, "\"%s\" is missing or too long", token_field.path);
+        return ESP_ERR_NOT_FOUND;
     }
-    if (json_arr_get_object(&jctx, 0) != OS_SUCCESS) {
-        int strlen;
-        if (json_arr_get_strlen(&jctx, 0, &strlen) != OS_SUCCESS) {
-            ESP_LOGE(TAG, "\"payloads\" array first element isn't an object nor a string:\n%s", js);
-        } else {
-            ESP_LOGE(TAG, "\"payloads\" array first element is a string:\n%s", js);
-        }
-        spotify_evt.type = UNKNOW;
-        return spotify_evt;
+    if (extract(jctx, &expiry_field, 1, expires_in, NULL) != OS_SUCCESS) {
+        *expires_in = 0;
     }
-    if (json_obj_get_array(&jctx, "events", &num_elem) != OS_SUCCESS) {
-        ESP_LOGE(TAG, "\"events\" array is missing:\n%s", js);
-        spotify_evt.type = UNKNOW;
-        return spotify_evt;
-        // here we can debug and get useful info that we can treat as events
+    return ESP_OK;
+}
+
+/* Devices without a name or an id are left out */
+esp_err_t parse_available_devices(jparse_ctx_t* jctx, List* devices_list)
+{
+    DevicesRead_t read = { .devices_list = devices_list };
+    if (read_devices(jctx, &read) != OS_SUCCESS) {
+        ESP_LOGE(TAG, "Error parsing devices:\n%s", jctx->js);
+        return ESP_ERR_INVALID_RESPONSE;
     }
-    if (num_elem == 0) {
-        ESP_LOGE(TAG, "\"events\" array is empty:\n%s", js);
-        spotify_evt.type = UNKNOW;
-        return spotify_evt;
+    if (!read.has_devices) {
+        ESP_LOGE(TAG, "\"" DEVICES_PATH "\" array is missing:\n%s", jctx->js);
+        return ESP_ERR_NOT_FOUND;
     }
-    if (num_elem > 1) {
-        ESP_LOGW(TAG, "\"events\" array has more than a element:\n%s", js);
+    return read.err;
+}
+
+esp_err_t parse_playlist(jparse_ctx_t* jctx, PlaylistItem_t* playlist_item)
+{
+    uint32_t found = 0;
+    if (extract(jctx, playlist_fields, NUM_FIELDS(playlist_fields), playlist_item, &found) != OS_SUCCESS) {
+        ESP_LOGW(TAG, "Playlist without \"%s\"", missing_field(playlist_fields, found));
+        return ESP_ERR_NOT_FOUND;
     }
-    if (json_arr_get_object(&jctx, 0) != OS_SUCCESS) {
-        ESP_LOGE(TAG, "\"events\" array first element isn't an object:\n%s", js);
-        spotify_evt.type = UNKNOW;
-        return spotify_evt;
+    return ESP_OK;
+}
+
+esp_err_t parse_connection_id(jparse_ctx_t* jctx, char** data)
+{
+    if (extract(jctx, connection_id_field, NUM_FIELDS(connection_id_field), data, NULL) != OS_SUCCESS) {
+        ESP_LOGE(TAG, "\"%s\" is missing:\n%s", connection_id_field[0].path, jctx->js);
+        return ESP_ERR_NOT_FOUND;
     }
-    // json_tok_t* t = jctx.cur;
-    // printf("token content: %.*s\n", (int)t->end - t->start, js + t->start);
+    return ESP_OK;
+}
 
-    bool match;
-    if (json_obj_match_string(&jctx, "type", "DEVICE_STATE_CHANGED", &match)) {
-        ESP_LOGE(TAG, "\"type\" key not found or its content is not a string:\n%s", js);
-        spotify_evt.type = UNKNOW;
-        return spotify_evt;
+/* With initial_state the player state was requested via http, it isn't
+ * wrapped in a ws event */
+SpotifyEvent_t parse_track(jparse_ctx_t* jctx, TrackInfo** track, int initial_state)
+{
+    assert(track && *track);
+    TrackRead_t read = { .artists = { .type = STRING_LIST } };
+    if (read_track(jctx, &read, !initial_state) != OS_SUCCESS) {
+        spotify_free_nodes(&read.artists);
+        ESP_LOGE(TAG, "Error parsing json:\n%s", jctx->js);
+        return (SpotifyEvent_t) { .type = PARSE_ERROR, .err = ESP_ERR_INVALID_RESPONSE };
+    }
+    SpotifyEvent_t spotify_evt = track_event(&read, !initial_state, *track, jctx->js);
+    // the artists of a new track are moved to it
+    spotify_free_nodes(&read.artists);
+    return spotify_evt;
+}
+
+/* Most player events only update the progress of the track playing, they are
+ * recognized in the raw message with a single scan that stops at the fields
+ * read. Returns false if the event has to go through parse_track() */
+bool parse_same_track(const char* js, TrackInfo* track)
+{
+    json_tok_t   toks[NUM_RAW_PATHS];
+    jparse_ctx_t raw = { .js = js };
+    json_str_t   type, id;
+    int64_t      progress_ms;
+    bool         is_playing;
+    if (json_raw_find_batch(js, strlen(js), 0, raw_paths, NUM_RAW_PATHS, toks) != OS_SUCCESS) {
+        return false;
+    }
+    raw.cur = &toks[RAW_TYPE];
+    if (json_cur_get_strview(&raw, &type) != OS_SUCCESS || type.len != (int)strlen("PLAYER_STATE_CHANGED")
+        || strncmp(type.str, "PLAYER_STATE_CHANGED", type.len) != 0) {
+        return false;
+    }
+    raw.cur = &toks[RAW_TRACK_ID];
+    if (json_cur_get_strview(&raw, &id) != OS_SUCCESS || id.len == 0 || strncmp(id.str, track->id, id.len) != 0
+        || track->id[id.len] != 0) {
+        return false;
+    }
+    raw.cur = &toks[RAW_PROGRESS];
+    if (json_cur_get_int64(&raw, &progress_ms) != OS_SUCCESS) {
+        return false;
+    }
+    raw.cur = &toks[RAW_IS_PLAYING];
+    if (json_cur_get_bool(&raw, &is_playing) != OS_SUCCESS) {
+        return false;
+    }
+    track->progress_ms = progress_ms;
+    track->isPlaying = is_playing;
+    return true;
+}
+
+/* Private functions ---------------------------------------------------------*/
+/* Event for a message parse_track() can't read, the client goes on with the
+ * next one */
+static SpotifyEvent_t parse_error(esp_err_t err, const char* field, const char* js)
+{
+    ESP_LOGE(TAG, "Unreadable player event (%s, \"%s\"):\n%s", esp_err_to_name(err), field, js);
+    return (SpotifyEvent_t) { .type = PARSE_ERROR, .err = err, .field = field };
+}
+
+/* The event is still sent, with what could be read. Only the first cause is
+ * kept */
+static void set_partial(SpotifyEvent_t* evt, esp_err_t err, const char* field)
+{
+    ESP_LOGW(TAG, "Player state without \"%s\" (%s)", field, esp_err_to_name(err));
+    if (evt->err == ESP_OK) {
+        evt->err = err;
+        evt->field = field;
     }
-    if (match) {
+}
+
+/* Path of the first field json_obj_extract() or json_sax_extract() didn't find */
+static const char* missing_field(const json_field_t* fields, uint32_t found)
+{
+    return fields[__builtin_ctz(~found)].path;
+}
+
+static void free_device(DeviceItem_t* item)
+{
+    if (item) {
+        free(item->name);
+        free(item->id);
+        free(item);
+    }
+}
+
+static bool strview_equals(const json_str_t* view, const char* str)
+{
+    return strncmp(view->str, str, view->len) == 0 && str[view->len] == 0;
+}
+
+/* Views are raw, the strings kept by the client are decoded */
+static char* dup_view(const json_str_t* view)
+{
+    char* dup = strndup(view->str, view->len);
+    if (dup) {
+        int len = json_str_unescape(dup, view->len);
+        dup[len < 0 ? 0 : len] = 0;
+    }
+    return dup;
+}
+
+/* Dealer events other than a player state change are handled here, returns
+ * false for a player state change */
+static bool other_event(SpotifyEvent_t* evt, const json_str_t* type, const char* js)
+{
+    if (strview_equals(type, "DEVICE_STATE_CHANGED")) {
         // TODO: manage this event
         ESP_LOGW(TAG, "Device state changed:\n%s", js);
-        spotify_evt.type = DEVICE_STATE_CHANGED;
+        evt->type = DEVICE_STATE_CHANGED;
+        return true;
+    }
+    // unknow event otherwise
+    return !strview_equals(type, "PLAYER_STATE_CHANGED");
+}
+
+/* What was read from a player event, whichever parser read it, as the event
+ * for the client */
+static SpotifyEvent_t track_event(TrackRead_t* read, bool wrapped, TrackInfo* track, const char* js)
+{
+    SpotifyEvent_t spotify_evt = { .type = UNKNOW };
+    if (wrapped) {
+        if (!read->type.str) {
+            return parse_error(ESP_ERR_NOT_FOUND, PLAYER_EVENT_ROOT "." EVENT_TYPE, js);
+        }
+        if (other_event(&spotify_evt, &read->type, js)) {
+            return spotify_evt;
+        }
+    }
+    if (wrapped && !read->has_state) {
+        return parse_error(ESP_ERR_NOT_FOUND, PLAYER_STATE_ROOT, js);
+    }
+
+    // nothing can be told without the track id, e.g. when "item" is null
+    PlayerState_t* state = &read->state;
+    if (!(read->found & 1) || state->id.len >= sizeof(track->id)) {
+        return parse_error(ESP_ERR_NOT_FOUND, state_fields[0].path, js);
+    }
+    spotify_evt.payload = track;
+    if (strview_equals(&state->id, track->id)) {
+        spotify_evt.type = SAME_TRACK;
+        uint32_t playback = read->found >> STATE_PLAYBACK_FIELDS;
+        if (playback & 1) {
+            track->progress_ms = state->progress_ms;
+        }
+        if (playback & 2) {
+            track->isPlaying = state->is_playing;
+        }
+        if (playback != 3) {
+            set_partial(&spotify_evt, ESP_ERR_NOT_FOUND, missing_field(&state_fields[STATE_PLAYBACK_FIELDS], playback));
+        }
+        // volume...
         return spotify_evt;
     }
-    ERR_CHECK(json_obj_match_string(&jctx, "type", "PLAYER_STATE_CHANGED", &match));
-    // TODO: continue relaxing the code by printing useful info of the error before returning
-    if (match) {
-        ERR_CHECK(json_obj_get_object(&jctx, "event"));
-        ERR_CHECK(json_obj_get_object(&jctx, "state"));
-    initial_state:
-        ERR_CHECK(json_obj_get_object(&jctx, "item"));
-        ERR_CHECK(json_obj_match_string(&jctx, "id", (*track)->id, &match));
-        if (match) {
-            ERR_CHECK(json_obj_leave_object(&jctx));
-            spotify_evt.type = SAME_TRACK;
-            spotify_evt.payload = *track;
-            int64_t progress;
-            ERR_CHECK(json_obj_get_int64(&jctx, "progress_ms", &progress));
-            if (progress != (*track)->progress_ms) {
-                (*track)->progress_ms = progress;
+
+    spotify_evt.type = NEW_TRACK;
+    spotify_clear_track(track);
+    memcpy(track->id, state->id.str, state->id.len);
+    track->id[state->id.len] = 0;
+    if (read->found & (1u << 1) && !(track->name = dup_view(&state->name))) {
+        set_partial(&spotify_evt, ESP_ERR_NO_MEM, state_fields[1].path);
+    }
+    if (read->found & (1u << 3) && !(track->album.name = dup_view(&state->album_name))) {
+        set_partial(&spotify_evt, ESP_ERR_NO_MEM, state_fields[3].path);
+    }
+    track->duration_ms = state->duration_ms;
+    track->progress_ms = state->progress_ms;
+    track->isPlaying = state->is_playing;
+    if (read->found != ALL_FIELDS(state_fields)) {
+        set_partial(&spotify_evt, ESP_ERR_NOT_FOUND, missing_field(state_fields, read->found));
+    }
+    // episodes have no artists, some items no images
+    track->artists = read->artists;
+    read->artists = (List) { .type = STRING_LIST };
+    if (!read->has_artists) {
+        set_partial(&spotify_evt, ESP_ERR_NOT_FOUND, ARTISTS_PATH);
+    } else if (read->artists_err == ESP_ERR_NOT_FOUND) {
+        set_partial(&spotify_evt, ESP_ERR_NOT_FOUND, ARTISTS_PATH "[].name");
+    } else if (read->artists_err != ESP_OK) {
+        set_partial(&spotify_evt, read->artists_err, ARTISTS_PATH);
+    }
+    if (!read->has_images) {
+        set_partial(&spotify_evt, ESP_ERR_NOT_FOUND, IMAGES_PATH);
+    } else if (read->cover_no_url) {
+        set_partial(&spotify_evt, ESP_ERR_NOT_FOUND, IMAGES_PATH "[].url");
+    } else if (read->cover.str && !(track->album.url_cover = dup_view(&read->cover))) {
+        set_partial(&spotify_evt, ESP_ERR_NO_MEM, IMAGES_PATH "[].url");
+    }
+    return spotify_evt;
+}
+
+/* item is NULL if it couldn't be allocated, it's freed if left out */
+static void add_device(DevicesRead_t* read, DeviceItem_t* item, uint32_t found)
+{
+    esp_err_t err = ESP_OK;
+    if (!item) {
+        err = ESP_ERR_NO_MEM;
+    } else if (found != ALL_FIELDS(device_fields)) {
+        ESP_LOGW(TAG, "Device without \"%s\" left out", missing_field(device_fields, found));
+        err = ESP_ERR_NOT_FOUND;
+        free_device(item);
+    } else if (!spotify_append_item_to_list(read->devices_list, (void*)item)) {
+        err = ESP_ERR_NO_MEM;
+        free_device(item);
+    }
+    if (read->err == ESP_OK) {
+        read->err = err;
+    }
+}
+
+static void add_artist(TrackRead_t* read, const Artist_t* artist, uint32_t found)
+{
+    char*     name = NULL;
+    esp_err_t err = ESP_OK;
+    if (found != ALL_FIELDS(artist_fields)) {
+        err = ESP_ERR_NOT_FOUND;
+    } else if (!(name = dup_view(&artist->name)) || !spotify_append_item_to_list(&read->artists, name)) {
+        free(name);
+        err = ESP_ERR_NO_MEM;
+    }
+    if (read->artists_err == ESP_OK) {
+        read->artists_err = err;
+    }
+}
+
+/* Only the first image of COVER_HEIGHT is kept */
+static void add_image(TrackRead_t* read, const Image_t* image, uint32_t found)
+{
+    if (read->cover.str || read->cover_no_url || !(found & 2) || image->height != COVER_HEIGHT) {
+        return;
+    }
+    if (found & 1) {
+        read->cover = image->url;
+    } else {
+        read->cover_no_url = true;
+    }
+}
+
+#ifdef CONFIG_SPOTIFY_CLIENT_SAX_PARSER
+static int extract(jparse_ctx_t* jctx, const json_field_t* fields, int num_fields, void* dest, uint32_t* found)
+{
+    return json_sax_extract(jctx->js, strlen(jctx->js), NULL, fields, num_fields, dest, found);
+}
+
+static int read_devices(jparse_ctx_t* jctx, DevicesRead_t* read)
+{
+    DevicesCtx_t ctx = { .read = read, .item_depth = -1 };
+    int          ret = json_sax_parse(jctx->js, strlen(jctx->js), devices_cb, &ctx);
+    free_device(ctx.item); // cut short by an error
+    return ret;
+}
+
+static int read_track(jparse_ctx_t* jctx, TrackRead_t* read, bool wrapped)
+{
+    TrackCtx_t ctx = { .read = read, .wrapped = wrapped, .event_depth = -1, .root_depth = -1, .elem_depth = -1 };
+    json_sax_t sax;
+    json_sax_begin(&sax, track_cb, &ctx);
+    if (json_sax_feed(&sax, jctx->js, strlen(jctx->js)) == OS_SUCCESS) {
+        json_sax_finish(&sax);
+    }
+    // the scan is stopped once it has what it needs
+    return (sax.status == JSON_SAX_DONE || sax.status == JSON_SAX_ERROR_STOPPED) ? OS_SUCCESS : -OS_FAIL;
+}
+
+/* Stores the field of fields the value reported is at, relative to the
+ * object at depth */
+static void store_field(json_sax_t* sax, const json_sax_evt_t* evt, int depth, const json_field_t* fields,
+    int num_fields, void* dest, uint32_t* found)
+{
+    for (int i = 0; i < num_fields; i++) {
+        if (!(*found & (1u << i)) && json_sax_path_match(sax, depth, fields[i].path)) {
+            if (json_sax_field_store(sax, evt, &fields[i], dest) == OS_SUCCESS) {
+                *found |= 1u << i;
+            }
+            return;
+        }
+    }
+}
+
+static int devices_cb(json_sax_t* sax, const json_sax_evt_t* evt, void* arg)
+{
+    DevicesCtx_t* ctx = (DevicesCtx_t*)arg;
+    if (ctx->item_depth < 0) {
+        if (evt->type == JSON_SAX_ARRAY_START && json_sax_path_match(sax, 0, DEVICES_PATH)) {
+            ctx->read->has_devices = true;
+        } else if (evt->type == JSON_SAX_OBJECT_START && json_sax_path_match(sax, 0, DEVICES_PATH "[]")) {
+            ctx->item = calloc(1, sizeof(*ctx->item));
+            ctx->item_depth = evt->depth;
+            ctx->found = 0;
+        }
+    } else if (evt->type == JSON_SAX_OBJECT_END && evt->depth == ctx->item_depth) {
+        add_device(ctx->read, ctx->item, ctx->found);
+        ctx->item = NULL;
+        ctx->item_depth = -1;
+    } else if (ctx->item) {
+        store_field(sax, evt, ctx->item_depth, device_fields, NUM_FIELDS(device_fields), ctx->item, &ctx->found);
+    }
+    return OS_SUCCESS;
+}
+
+static int track_cb(json_sax_t* sax, const json_sax_evt_t* evt, void* arg)
+{
+    TrackCtx_t*  ctx = (TrackCtx_t*)arg;
+    TrackRead_t* read = ctx->read;
+    bool         container = evt->type == JSON_SAX_OBJECT_START || evt->type == JSON_SAX_ARRAY_START;
+    if (ctx->root_depth < 0) {
+        if (ctx->wrapped && ctx->event_depth < 0) {
+            if (evt->type == JSON_SAX_OBJECT_START && json_sax_path_match(sax, 0, PLAYER_EVENT_ROOT)) {
+                ctx->event_depth = evt->depth;
             }
-            bool is_playing;
-            ERR_CHECK(json_obj_get_bool(&jctx, "is_playing", &is_playing));
-            if (is_playing != (*track)->isPlaying) {
-                (*track)->isPlaying = is_playing;
+        } else if (ctx->wrapped && evt->depth == ctx->event_depth && evt->type == JSON_SAX_OBJECT_END) {
+            return -OS_FAIL; // only the first event is read
+        } else if (ctx->wrapped && !read->type.str && json_sax_path_match(sax, ctx->event_depth, event_fields[0].path)
+                   && json_sax_field_store(sax, evt, &event_fields[0], read) == OS_SUCCESS) {
+            // nothing else to read unless it's a player state
+            if (ctx->state_done || !strview_equals(&read->type, "PLAYER_STATE_CHANGED")) {
+                return -OS_FAIL;
             }
-            // volume...
-        } else {
-            spotify_evt.type = NEW_TRACK;
-            spotify_evt.payload = *track;
-            spotify_clear_track(*track);
-            ERR_CHECK(json_obj_get_string(&jctx, "id", (*track)->id, 30));
-            ERR_CHECK(json_obj_dup_string(&jctx, "name", &(*track)->name));
-            ERR_CHECK(json_obj_get_int64(&jctx, "duration_ms", &(*track)->duration_ms));
-            ERR_CHECK(json_obj_get_array(&jctx, "artists", &num_elem));
-            for (int i = 0; i < num_elem; i++) {
-                ERR_CHECK(json_arr_get_object(&jctx, i));
-                char* artist_name;
-                ERR_CHECK(json_obj_dup_string(&jctx, "name", &artist_name));
-                assert(spotify_append_item_to_list(&(*track)->artists, artist_name));
-                ERR_CHECK(json_arr_leave_object(&jctx));
+        } else if (ctx->state_done) {
+            return container ? JSON_SAX_SKIP : OS_SUCCESS;
+        } else if (evt->type == JSON_SAX_OBJECT_START
+                   && (ctx->wrapped ? json_sax_path_match(sax, ctx->event_depth, EVENT_STATE_PATH) : evt->depth == 0)) {
+            ctx->root_depth = evt->depth;
+            read->has_state = true;
+        }
+        return OS_SUCCESS;
+    }
+    if (container) {
+        for (int i = 0; i < NUM_FIELDS(state_containers); i++) {
+            if (json_sax_path_match(sax, ctx->root_depth, state_containers[i])) {
+                break;
+            } else if (i == NUM_FIELDS(state_containers) - 1) {
+                return JSON_SAX_SKIP;
             }
-            ERR_CHECK(json_obj_leave_array(&jctx));
-            ERR_CHECK(json_obj_get_object(&jctx, "album"));
-            ERR_CHECK(json_obj_dup_string(&jctx, "name", &(*track)->album.name));
-            ERR_CHECK(json_obj_get_array(&jctx, "images", &num_elem));
-            int h;
-            for (int i = 0; i < num_elem; i++) {
-                ERR_CHECK(json_arr_get_object(&jctx, i));
-                ERR_CHECK(json_obj_get_int(&jctx, "height", &h));
-                if (h == 300) {
-                    ERR_CHECK(json_obj_dup_string(&jctx, "url", &(*track)->album.url_cover));
-                    ERR_CHECK(json_arr_leave_object(&jctx));
-                    break;
-                }
-                ERR_CHECK(json_arr_leave_object(&jctx));
+        }
+    }
+    if (ctx->elem_depth >= 0) {
+        if (evt->type == JSON_SAX_OBJECT_END && evt->depth == ctx->elem_depth) {
+            if (ctx->is_artist) {
+                add_artist(read, &ctx->artist, ctx->elem_found);
+            } else {
+                add_image(read, &ctx->image, ctx->elem_found);
             }
-            ERR_CHECK(json_obj_leave_array(&jctx));
-            ERR_CHECK(json_obj_leave_object(&jctx));
-            ERR_CHECK(json_obj_leave_object(&jctx));
-            ERR_CHECK(json_obj_get_int64(&jctx, "progress_ms", &(*track)->progress_ms));
-            ERR_CHECK(json_obj_get_bool(&jctx, "is_playing", &(*track)->isPlaying));
+            ctx->elem_depth = -1;
+        } else if (ctx->is_artist) {
+            store_field(sax, evt, ctx->elem_depth, artist_fields, NUM_FIELDS(artist_fields), &ctx->artist,
+                &ctx->elem_found);
+        } else {
+            store_field(sax, evt, ctx->elem_depth, image_fields, NUM_FIELDS(image_fields), &ctx->image,
+                &ctx->elem_found);
         }
+        return OS_SUCCESS;
+    }
+    switch (evt->type) {
+    case JSON_SAX_STRING:
+    case JSON_SAX_PRIMITIVE:
+        store_field(sax, evt, ctx->root_depth, state_fields, NUM_FIELDS(state_fields), &read->state, &read->found);
+        break;
+    case JSON_SAX_OBJECT_START:
+        ctx->is_artist = json_sax_path_match(sax, ctx->root_depth, ARTISTS_PATH "[]");
+        if (ctx->is_artist || json_sax_path_match(sax, ctx->root_depth, IMAGES_PATH "[]")) {
+            ctx->elem_depth = evt->depth;
+            ctx->elem_found = 0;
+        }
+        break;
+    case JSON_SAX_ARRAY_START:
+        if (json_sax_path_match(sax, ctx->root_depth, ARTISTS_PATH)) {
+            read->has_artists = true;
+        } else if (json_sax_path_match(sax, ctx->root_depth, IMAGES_PATH)) {
+            read->has_images = true;
+        }
+        break;
+    case JSON_SAX_OBJECT_END:
+        if (evt->depth == ctx->root_depth) {
+            ctx->root_depth = -1;
+            ctx->state_done = true;
+            // the type of a dealer event may come after its state
+            return (!ctx->wrapped || read->type.str) ? -OS_FAIL : OS_SUCCESS;
+        }
+        break;
+    default:
+        break;
+    }
+    return OS_SUCCESS;
+}
+#else
+static int extract(jparse_ctx_t* jctx, const json_field_t* fields, int num_fields, void* dest, uint32_t* found)
+{
+    return json_obj_extract(jctx, fields, num_fields, dest, found);
+}
 
-        return spotify_evt;
+static int read_devices(jparse_ctx_t* jctx, DevicesRead_t* read)
+{
+    int         num_elem;
+    json_iter_t it;
+    if (json_obj_get_array(jctx, DEVICES_PATH, &num_elem) != OS_SUCCESS
+        || json_arr_iter_begin(jctx, &it) != OS_SUCCESS) {
+        return OS_SUCCESS; // has_devices tells
     }
-    // unknow event
-    spotify_evt.type = UNKNOW;
-    return spotify_evt;
+    read->has_devices = true;
+    while (json_arr_iter_next(jctx, &it) == OS_SUCCESS) {
+        DeviceItem_t* item = calloc(1, sizeof(*item));
+        uint32_t      found = 0;
+        if (item) {
+            json_obj_extract(jctx, device_fields, NUM_FIELDS(device_fields), item, &found);
+        }
+        add_device(read, item, found);
+    }
+    return OS_SUCCESS;
 }
 
-/* Private functions ---------------------------------------------------------*/
+/* Only the first event of a dealer message is read */
+static int read_track(jparse_ctx_t* jctx, TrackRead_t* read, bool wrapped)
+{
+    json_tok_t* root = jctx->cur;
+    if (wrapped) {
+        if (json_path_find(jctx, &paths[PATH_EVENT]) != OS_SUCCESS || jctx->cur->type != JSMN_OBJECT) {
+            jctx->cur = root;
+            return OS_SUCCESS;
+        }
+        json_obj_extract(jctx, event_fields, NUM_FIELDS(event_fields), read, NULL);
+        // nothing else to read unless it's a player state
+        if (!read->type.str || !strview_equals(&read->type, "PLAYER_STATE_CHANGED")
+            || json_path_find(jctx, &paths[PATH_STATE]) != OS_SUCCESS) {
+            jctx->cur = root;
+            return OS_SUCCESS;
+        }
+    }
+    if (jctx->cur->type == JSMN_OBJECT) {
+        read->has_state = true;
+        read_state(jctx, read);
+    }
+    jctx->cur = root;
+    return OS_SUCCESS;
+}
+
+static void read_state(jparse_ctx_t* jctx, TrackRead_t* read)
+{
+    json_tok_t* state = jctx->cur;
+    json_tok_t* elems[NUM_PATHS - PATH_ARTISTS];
+    json_iter_t it;
+    json_obj_extract(jctx, state_fields, NUM_FIELDS(state_fields), &read->state, &read->found);
+    json_path_find_batch(jctx, &paths[PATH_ARTISTS], NUM_PATHS - PATH_ARTISTS, elems);
+    jctx->cur = elems[PATH_ARTISTS - PATH_ARTISTS];
+    if (jctx->cur && json_arr_iter_begin(jctx, &it) == OS_SUCCESS) {
+        read->has_artists = true;
+        while (json_arr_iter_next(jctx, &it) == OS_SUCCESS) {
+            Artist_t artist;
+            uint32_t found = 0;
+            json_obj_extract(jctx, artist_fields, NUM_FIELDS(artist_fields), &artist, &found);
+            add_artist(read, &artist, found);
+        }
+    }
+    jctx->cur = elems[PATH_IMAGES - PATH_ARTISTS];
+    if (jctx->cur && json_arr_iter_begin(jctx, &it) == OS_SUCCESS) {
+        read->has_images = true;
+        while (json_arr_iter_next(jctx, &it) == OS_SUCCESS) {
+            Image_t  image;
+            uint32_t found = 0;
+            json_obj_extract(jctx, image_fields, NUM_FIELDS(image_fields), &image, &found);
+            add_image(read, &image, found);
+        }
+    }
+    jctx->cur = state;
+}
+
+static void compile_paths(void)
+{
+    for (int i = 0; i < NUM_PATHS; i++) {
+        ERR_CHECK(json_path_compile(&paths[i], path_strs[i]));
+    }
+    for (int i = 0; i < NUM_FIELDS(event_query); i++) {
+        ERR_CHECK(json_path_compile(&event_query[i], event_query_strs[i]));
+    }
+}
+#endif
+
+/* NULL if the calling task has none */
+static ParsePool_t* task_pool(void)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < MAX_POOLS; i++) {
+        if (pool_tasks[i] == task) {
+            return pools[i];
+        }
+    }
+    return NULL;
+}
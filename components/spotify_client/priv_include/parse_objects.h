@@ -8,6 +8,9 @@ extern "C" {
 #include <stdbool.h>
 #include <time.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "json_parser.h"
 #include "spotify_client.h"
 
 /* Exported types ------------------------------------------------------------*/
@@ -15,11 +18,19 @@ extern "C" {
 /* Globally scoped variables declarations ------------------------------------*/
 
 /* Exported functions prototypes ---------------------------------------------*/
-void           parse_access_token(const char* js, char* access_token, int size);
-void           parse_playlist(const char* js, PlaylistItem_t* playlist_item);
-void           parse_available_devices(const char* js, List*);
-void           parse_connection_id(const char* js, char** str);
-SpotifyEvent_t parse_track(const char* js, TrackInfo** track_info, int initial_state);
+void           parse_objects_init(void);
+esp_err_t      parse_objects_attach(int num_tokens);
+void           parse_objects_detach(TaskHandle_t task);
+esp_err_t      parse_json_start(jparse_ctx_t* jctx, const char* js);
+esp_err_t      parse_track_start(jparse_ctx_t* jctx, const char* js);
+bool           parse_same_track(const char* js, TrackInfo* track_info);
+esp_err_t      parse_json_stream_start(jparse_ctx_t* jctx, char* buf, size_t size);
+void           parse_json_end(jparse_ctx_t* jctx);
+esp_err_t      parse_access_token(jparse_ctx_t* jctx, char* access_token, int size, int* expires_in);
+esp_err_t      parse_playlist(jparse_ctx_t* jctx, PlaylistItem_t* playlist_item);
+esp_err_t      parse_available_devices(jparse_ctx_t* jctx, List*);
+esp_err_t      parse_connection_id(jparse_ctx_t* jctx, char** str);
+SpotifyEvent_t parse_track(jparse_ctx_t* jctx, TrackInfo** track_info, int initial_state);
 
 #ifdef __cplusplus
 }
@@ -20,6 +20,7 @@ extern "C" {
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "json_parser.h"
 
 /* Exported macro ------------------------------------------------------------*/
 // eventgroup macros
@@ -42,6 +43,7 @@ typedef struct {
     size_t buffer_size;
     size_t current_size;
     void * ctx;
+    jparse_ctx_t jctx; /* tokens of a JSON body, built as it's received */
 } evt_user_data_t;
 
 /* Exported variables declarations -------------------------------------------*/
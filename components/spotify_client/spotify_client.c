@@ -1,14 +1,17 @@
 /* Includes ------------------------------------------------------------------*/
 #include "spotify_client.h"
 #include "esp_log.h"
+#include "esp_random.h"
 #include "esp_system.h"
 #include "esp_websocket_client.h"
+#include "freertos/timers.h"
 #include "handler_callbacks.h"
 #include "limits.h"
 #include "parse_objects.h"
 #include "spotify_client_priv.h"
 #include "string_utils.h"
 #include <string.h>
+#include <strings.h>
 
 /* Private macro -------------------------------------------------------------*/
 #define ACCESS_TOKEN_URL "https://discord.com/api/v8/users/@me/connections/spotify/" CONFIG_SPOTIFY_UID "/access-token"
@@ -20,13 +23,37 @@
 #define PREV_TRACK PLAYER "/previous"
 #define NEXT_TRACK PLAYER "/next"
 #define VOLUME PLAYER "/volume?volume_percent="
+#define LIBRARY_TRACKS "/me/tracks"
 #define PLAYERURL(ENDPOINT) "https://api.spotify.com/v1" ENDPOINT
 #define ACQUIRE_LOCK(mux) xSemaphoreTake(mux, portMAX_DELAY)
 #define RELEASE_LOCK(mux) xSemaphoreGive(mux)
-#define RETRIES_ERR_CONN 3
+#define RETRIES_ERR_CONN 3 // of a request, failed or rate limited
+#define RETRY_BASE_MS 500 // backoff before the first retry, doubled on each
+#define RETRY_MAX_MS 8000 // longest wait for a retry, Retry-After included
+#define BREAKER_THRESHOLD 5 // attempts failed in a row that trip a host's breaker
+#define BREAKER_COOLDOWN_MS 30000 // the requests to a tripped host fail fast meanwhile
+#define HTTP_TOO_MANY_REQUESTS 429
+#define HTTP_SERVICE_UNAVAILABLE 503
 #define MAX_HTTP_BUFFER 8192
+#define MAX_TOKEN_BUFFER 1024
 #define MAX_WS_BUFFER 4096
-#define SPRINTF_BUF_SIZE 100
+#define JSON_CHUNK_SIZE 64 // request bodies are written to the connection in chunks of this size
+#define LIBRARY_MAX_IDS 50 // per request, more are sent in several
+#define MAX_HOST_LEN 64
+#define ACCESS_TOKEN_SIZE 400 // "Bearer " included
+#define REQUEST_QUEUE_LEN 4 // requests of a class waiting for their worker
+#define WORKER_STACK_SIZE 4096
+#define SMALL_POOL_TOKENS 128 // parse pool of the tasks reading small messages, see parse_objects_attach()
+#ifdef CONFIG_SPOTIFY_CLIENT_SAX_PARSER
+#define API_POOL_TOKENS 0 // the SAX parsers take no tokens
+#else
+#define API_POOL_TOKENS CONFIG_SPOTIFY_CLIENT_TASK_TOKENS
+#endif
+#define HTTP_TIMEOUT_MS 5000 // esp_http_client's default, a deadline may lower it
+#define TOKEN_LIFETIME_S 3600 // of a Spotify access token, if the response doesn't say
+#define TOKEN_REFRESH_MARGIN_S 300 // the token is refreshed this long before it expires
+#define TOKEN_RETRY_MS 30000 // after a refresh failed
+#define PLAYER_RETRY_MS 10000 // before starting the player again, at least the hold of a tripped breaker
 
 /* Private types -------------------------------------------------------------*/
 typedef enum
@@ -40,23 +67,165 @@ typedef enum
     GET_STATE
 } PlayerCommand_t;
 
+/* Hosts the client talks to over HTTP, each on its own connection */
+typedef enum
+{
+    HOST_API,
+    HOST_TOKEN,  /* the access token */
+    HOST_IMAGES, /* album covers */
+    HOST_API_BULK, /* the API again, for bulk transfers, see REQ_BULK */
+    NUM_HOSTS
+} Host_t;
+
+typedef struct
+{
+    esp_spotify_client_handle_t client;
+    esp_http_client_handle_t handle;
+    SemaphoreHandle_t lock; /* one request at a time, held until its response is read */
+    http_event_handle_cb http_event_cb;
+    evt_user_data_t user_data;
+    int retry_after_ms;     /* of the last response, -1 if it had none */
+    uint8_t failures;       /* attempts failed in a row, see BREAKER_THRESHOLD */
+    bool tripped;           /* the host's requests fail fast until tripped_until */
+    TickType_t tripped_until;
+    bool connected;         /* kept open since the last request */
+    bool responded;         /* headers of the response to the request being sent came */
+    const char *host;       /* of the request prepared, not NUL terminated */
+    int host_len;
+    char session_host[MAX_HOST_LEN]; /* of the TLS session saved by the last connection */
+    SpotifyConnStats_t stats;
+} HttpClient_t;
+
+/* Requests are run by the worker of their class, which takes the highest
+ * class waiting first. Bulk transfers and token fetches have their own
+ * worker and connections: a command waits at most for the refresh request
+ * in flight on the API connection, never behind a playlist or cover
+ * download, nor a round trip to the token endpoint */
+typedef enum
+{
+    REQ_INTERACTIVE, /* player commands, playback and library changes */
+    REQ_REFRESH,     /* player state, devices, the dealer session */
+    REQ_TOKEN,       /* the access token */
+    REQ_BULK,        /* playlists, covers */
+    NUM_REQ_CLASSES
+} ReqClass_t;
+
+typedef enum
+{
+    WORKER_API,  /* REQ_INTERACTIVE and REQ_REFRESH, on HOST_API */
+    WORKER_BULK, /* REQ_TOKEN and REQ_BULK, on HOST_TOKEN, HOST_API_BULK and HOST_IMAGES */
+    NUM_WORKERS
+} WorkerId_t;
+
+typedef esp_err_t (*request_fn_t)(esp_spotify_client_handle_t client, void *arg);
+
+typedef struct
+{
+    request_fn_t fn; /* run on the worker, so are the parses of its response */
+    void *arg;
+    esp_err_t err;   /* returned by fn */
+    SemaphoreHandle_t done; /* given once fn returned */
+    StaticSemaphore_t done_buf;
+    void (*complete)(void *arg); /* run by the worker instead of giving done, if set */
+    TickType_t deadline;         /* tick count it expires at, if has_deadline */
+    bool has_deadline;
+    volatile bool cancelled;
+    bool aborted; /* a response was cut short for it, whatever the HTTP client then returned */
+} Request_t;
+
+typedef struct
+{
+    esp_spotify_client_handle_t client;
+    WorkerId_t id;
+    TaskHandle_t task;
+    Request_t *current; /* being run */
+} Worker_t;
+
+typedef struct
+{
+    PlayerCommand_t cmd;
+    HttpStatus_Code status_code;
+} CmdRequest_t;
+
+typedef struct
+{
+    HttpStatus_Code status_code;
+    SpotifyEvent_t evt; /* of the state read, if status_code is HttpStatus_Ok */
+} StateRequest_t;
+
+typedef struct
+{
+    const char *url;
+    uint8_t *out_buf;
+    size_t buf_size;
+    ssize_t data_read;
+} CoverRequest_t;
+
+/* Writes a request body, returns json_gen_str_end() */
+typedef int (*json_body_cb_t)(json_gen_str_t *jstr, const void *arg);
+
+typedef struct
+{
+    const char *name; /* of the array */
+    const char *const *ids;
+    int num_ids;
+    int play; /* -1 to leave it out */
+} IdsBody_t;
+
+typedef struct
+{
+    esp_http_client_method_t method;
+    const char *url;
+    json_body_cb_t body;
+    const void *arg;
+    HttpStatus_Code status_code;
+} JsonRequest_t;
+
+typedef enum
+{
+    ASYNC_PLAYLISTS,
+    ASYNC_DEVICES,
+    ASYNC_PLAY,
+    ASYNC_COVER,
+} AsyncKind_t;
+
+/* A request submitted by one of the _async() functions */
+struct spotify_request
+{
+    Request_t request; /* its arg is the spotify_request */
+    esp_spotify_client_handle_t client;
+    AsyncKind_t kind;
+    spotify_request_cb_t cb;
+    void *user_ctx;
+    TaskHandle_t owner; /* notified once it completes, if there's no cb */
+    spotify_request_handle_t next; /* in the client's list of requests not complete */
+    SpotifyResult_t result;
+    char *str; /* copy of the uri to play or the cover url */
+    PlayOptions_t options;
+    JsonRequest_t json;
+    CoverRequest_t cover;
+};
+
 struct esp_spotify_client
 {
     TrackInfo *track_info;
-    char sprintf_buf[SPRINTF_BUF_SIZE];
-    SemaphoreHandle_t http_buf_lock; /* Mutex to manage access to the http client buffer */
-    uint8_t s_retries;               /* number of retries on error connections */
     struct
     {
-        char value[400];
-        time_t expiresIn;
+        char value[2][ACCESS_TOKEN_SIZE]; /* the one in use and the next, see set_access_token() */
+        volatile uint8_t current;
+        time_t expiresIn; /* seconds the one in use lasts from when it was obtained */
+        TimerHandle_t refresh_timer;
+        Request_t refresh; /* queued by the timer */
+        volatile bool refresh_queued;
+        volatile uint32_t fetches; /* completed, see get_access_token() */
+        esp_err_t fetch_err;       /* of the last one */
     } access_token;
-    struct
-    {
-        esp_http_client_handle_t handle;
-        http_event_handle_cb http_event_cb;
-        evt_user_data_t user_data;
-    } http_client;
+    HttpClient_t http[NUM_HOSTS];
+    QueueHandle_t requests[NUM_REQ_CLASSES]; /* of Request_t *, waiting for their worker */
+    Worker_t workers[NUM_WORKERS];
+    TickType_t request_timeout; /* of the requests of the blocking functions */
+    SemaphoreHandle_t async_lock; /* of pending */
+    spotify_request_handle_t pending; /* asynchronous requests not complete, they can be cancelled */
     struct
     {
         esp_websocket_client_handle_t handle;
@@ -68,6 +237,15 @@ struct esp_spotify_client
 
 /* Locally scoped variables --------------------------------------------------*/
 static const char *TAG = "spotify_client";
+static const WorkerId_t class_worker[NUM_REQ_CLASSES] = {
+    [REQ_INTERACTIVE] = WORKER_API,
+    [REQ_REFRESH] = WORKER_API,
+    [REQ_TOKEN] = WORKER_BULK,
+    [REQ_BULK] = WORKER_BULK,
+};
+static const char *const worker_names[NUM_WORKERS] = { "spotify_api", "spotify_bulk" };
+// player states and devices on the API, playlist items and tokens on the bulk
+static const int worker_tokens[NUM_WORKERS] = { API_POOL_TOKENS, SMALL_POOL_TOKENS };
 
 /* Globally scoped variables definitions -------------------------------------*/
 
@@ -77,15 +255,56 @@ extern const char certs_pem_end[] asm("_binary_certs_pem_end");
 
 /* Private function prototypes -----------------------------------------------*/
 static esp_err_t get_access_token(esp_spotify_client_handle_t client);
+static esp_err_t token_request(esp_spotify_client_handle_t client, void *arg);
+static esp_err_t fetch_access_token(esp_spotify_client_handle_t client, uint32_t fetches);
 static esp_err_t http_event_cb_wrapper(esp_http_client_event_t *evt);
 static void player_task(void *pvParameters);
-static esp_err_t confirm_ws_session(esp_spotify_client_handle_t client, char *conn_id);
+static esp_err_t confirm_ws_session(esp_spotify_client_handle_t client, void *arg);
+static void request_worker(void *pvParameters);
+static esp_err_t submit_request(esp_spotify_client_handle_t client, ReqClass_t cls, request_fn_t fn, void *arg);
+static esp_err_t cmd_request(esp_spotify_client_handle_t client, void *arg);
+static esp_err_t state_request(esp_spotify_client_handle_t client, void *arg);
+static esp_err_t playlists_request(esp_spotify_client_handle_t client, void *arg);
+static esp_err_t devices_request(esp_spotify_client_handle_t client, void *arg);
+static esp_err_t cover_request(esp_spotify_client_handle_t client, void *arg);
+static esp_err_t json_request(esp_spotify_client_handle_t client, void *arg);
+static esp_err_t queue_request(esp_spotify_client_handle_t client, ReqClass_t cls, Request_t *req, TickType_t xTicksToWait);
+static spotify_request_handle_t async_new(AsyncKind_t kind, const char *str, TickType_t timeout, spotify_request_cb_t cb, void *user_ctx);
+static spotify_request_handle_t async_submit(esp_spotify_client_handle_t client, ReqClass_t cls, spotify_request_handle_t req);
+static esp_err_t async_request(esp_spotify_client_handle_t client, void *arg);
+static void async_complete(void *arg);
+static void async_free(spotify_request_handle_t req);
+static void async_unlist(esp_spotify_client_handle_t client, spotify_request_handle_t req);
+static void set_deadline(Request_t *req, TickType_t timeout);
+static bool request_expired(const Request_t *req);
+static Request_t *current_request(esp_spotify_client_handle_t client);
 static void free_track(TrackInfo *track_info);
-static esp_err_t http_retries_available(esp_spotify_client_handle_t client, esp_err_t err);
+static esp_err_t http_client_init(esp_spotify_client_handle_t client, HttpClient_t *http, const char *url, size_t buffer_size, http_event_handle_cb http_event_cb);
+static void http_client_deinit(HttpClient_t *http);
+static TickType_t retry_delay(int attempt);
+static bool retry_wait(Request_t *req, TickType_t wait);
+static bool breaker_tripped(HttpClient_t *http);
+static TickType_t player_retry_wait(esp_spotify_client_handle_t client);
+static void breaker_failure(HttpClient_t *http, TickType_t hold);
 static void debug_mem();
 static bool access_token_empty(esp_spotify_client_handle_t client);
-static void prepare_client(esp_http_client_handle_t http_client, const char *auth, const char *content_type, const char *url, esp_http_client_method_t method);
+static const char *access_token(esp_spotify_client_handle_t client);
+static void schedule_refresh(esp_spotify_client_handle_t client, int expires_in);
+static void refresh_timer_cb(TimerHandle_t timer);
+static esp_err_t refresh_request(esp_spotify_client_handle_t client, void *arg);
+static void refresh_complete(void *arg);
+static void prepare_client(HttpClient_t *http, const char *auth, const char *content_type, const char *url, esp_http_client_method_t method);
 static esp_err_t player_cmd(esp_spotify_client_handle_t client, PlayerCommand_t cmd, void *payload, HttpStatus_Code *status_code);
+static esp_err_t send_json(esp_spotify_client_handle_t client, esp_http_client_method_t method, const char *url, json_body_cb_t body, const void *arg, HttpStatus_Code *status_code);
+static esp_err_t http_send(HttpClient_t *http, json_body_cb_t body, const void *arg);
+static esp_err_t http_attempt(HttpClient_t *http, Request_t *req, json_body_cb_t body, const void *arg);
+static void count_handshake(HttpClient_t *http);
+static void set_access_token(esp_spotify_client_handle_t client, const char *token);
+static esp_err_t http_perform_json(esp_http_client_handle_t http_client, json_body_cb_t body, const void *arg);
+static int http_write_cb(const char *buf, int len, void *priv);
+static int play_body(json_gen_str_t *jstr, const void *arg);
+static int ids_body(json_gen_str_t *jstr, const void *arg);
+static esp_err_t edit_library(esp_spotify_client_handle_t client, esp_http_client_method_t method, const char *const *ids, int num_ids, HttpStatus_Code *status_code);
 
 /* Exported functions --------------------------------------------------------*/
 esp_spotify_client_handle_t spotify_client_init(UBaseType_t priority)
@@ -97,14 +316,6 @@ esp_spotify_client_handle_t spotify_client_init(UBaseType_t priority)
         return NULL;
     }
 
-    client->http_client.user_data.buffer = (uint8_t *)calloc(1, MAX_HTTP_BUFFER);
-    if (!client->http_client.user_data.buffer)
-    {
-        spotify_client_deinit(client);
-        return NULL;
-    }
-    client->http_client.user_data.buffer_size = MAX_HTTP_BUFFER;
-
     client->track_info = (TrackInfo *)calloc(1, sizeof(TrackInfo));
     if (!client->track_info)
     {
@@ -113,15 +324,16 @@ esp_spotify_client_handle_t spotify_client_init(UBaseType_t priority)
         return NULL;
     }
     client->track_info->artists.type = STRING_LIST;
-    strcpy(client->access_token.value, "Bearer ");
-
-    esp_http_client_config_t http_cfg = {
-        .url = "https://api.spotify.com/v1",
-        .user_data = client,
-        .event_handler = http_event_cb_wrapper,
-        .cert_pem = certs_pem_start,
-        .buffer_size_tx = DEFAULT_HTTP_BUF_SIZE + 256,
-    };
+    strcpy(client->access_token.value[0], "Bearer ");
+    strcpy(client->access_token.value[1], "Bearer ");
+    client->access_token.refresh = (Request_t){ .fn = refresh_request, .arg = client, .complete = refresh_complete };
+    client->access_token.refresh_timer = xTimerCreate("spotify_token", 1, pdFALSE, client, refresh_timer_cb);
+    if (!client->access_token.refresh_timer)
+    {
+        ESP_LOGE(TAG, "Failed to create the token refresh timer");
+        spotify_client_deinit(client);
+        return NULL;
+    }
 
     esp_websocket_client_config_t websocket_cfg = {
         .uri = "wss://dealer.spotify.com",
@@ -139,14 +351,16 @@ esp_spotify_client_handle_t spotify_client_init(UBaseType_t priority)
         return NULL;
     }
 
-    client->http_client.handle = esp_http_client_init(&http_cfg);
-    if (!client->http_client.handle)
+    // a download or a token request doesn't take the API connection, nor
+    // waits for the request on it. Covers go to the caller's buffer
+    if (http_client_init(client, &client->http[HOST_API], PLAYERURL(""), MAX_HTTP_BUFFER, json_http_event_cb) != ESP_OK ||
+        http_client_init(client, &client->http[HOST_TOKEN], ACCESS_TOKEN_URL, MAX_TOKEN_BUFFER, json_http_event_cb) != ESP_OK ||
+        http_client_init(client, &client->http[HOST_IMAGES], "https://i.scdn.co", 0, default_http_event_cb) != ESP_OK ||
+        http_client_init(client, &client->http[HOST_API_BULK], PLAYERURL(""), MAX_HTTP_BUFFER, playlist_http_event_cb) != ESP_OK)
     {
-        ESP_LOGE(TAG, "Error on esp_http_client_init()");
         spotify_client_deinit(client);
         return NULL;
     }
-    client->http_client.http_event_cb = json_http_event_cb;
     client->ws_client.handle = esp_websocket_client_init(&websocket_cfg);
     if (!client->ws_client.handle)
     {
@@ -163,14 +377,6 @@ esp_spotify_client_handle_t spotify_client_init(UBaseType_t priority)
     }
     client->ws_client.user_data.buffer_size = MAX_WS_BUFFER;
 
-    client->http_buf_lock = xSemaphoreCreateMutex();
-    if (!client->http_buf_lock)
-    {
-        ESP_LOGE(TAG, "Failed to create mutex");
-        spotify_client_deinit(client);
-        return NULL;
-    }
-
     client->event_queue = xQueueCreate(1, sizeof(SpotifyEvent_t));
     if (!client->event_queue)
     {
@@ -187,6 +393,37 @@ esp_spotify_client_handle_t spotify_client_init(UBaseType_t priority)
     }
     client->ws_client.user_data.ctx = client->ws_client.event_group;
 
+    for (int i = 0; i < NUM_REQ_CLASSES; i++)
+    {
+        if (!(client->requests[i] = xQueueCreate(REQUEST_QUEUE_LEN, sizeof(Request_t *))))
+        {
+            ESP_LOGE(TAG, "Failed to create queue for requests");
+            spotify_client_deinit(client);
+            return NULL;
+        }
+    }
+
+    client->request_timeout = portMAX_DELAY;
+    if (!(client->async_lock = xSemaphoreCreateMutex()))
+    {
+        ESP_LOGE(TAG, "Failed to create mutex for requests");
+        spotify_client_deinit(client);
+        return NULL;
+    }
+
+    parse_objects_init();
+    for (int i = 0; i < NUM_WORKERS; i++)
+    {
+        Worker_t *worker = &client->workers[i];
+        worker->client = client;
+        worker->id = i;
+        if (!xTaskCreate(request_worker, worker_names[i], WORKER_STACK_SIZE, worker, priority, &worker->task))
+        {
+            ESP_LOGE(TAG, "Failed to create %s task", worker_names[i]);
+            spotify_client_deinit(client);
+            return NULL;
+        }
+    }
     int res = xTaskCreate(player_task, "player_task", 4096, client, priority, NULL);
     if (!res)
     {
@@ -205,10 +442,32 @@ esp_err_t spotify_client_deinit(esp_spotify_client_handle_t client)
     {
         return ESP_FAIL;
     }
-    if (client->http_client.user_data.buffer)
+    if (client->access_token.refresh_timer)
+    {
+        xTimerDelete(client->access_token.refresh_timer, portMAX_DELAY);
+        client->access_token.refresh_timer = NULL;
+    }
+    for (int i = 0; i < NUM_WORKERS; i++)
+    {
+        if (client->workers[i].task)
+        {
+            vTaskDelete(client->workers[i].task);
+            parse_objects_detach(client->workers[i].task);
+            client->workers[i].task = NULL;
+        }
+    }
+    for (int i = 0; i < NUM_REQ_CLASSES; i++)
+    {
+        if (client->requests[i])
+        {
+            vQueueDelete(client->requests[i]);
+            client->requests[i] = NULL;
+        }
+    }
+    if (client->async_lock)
     {
-        free(client->http_client.user_data.buffer);
-        client->http_client.user_data.buffer = NULL;
+        vSemaphoreDelete(client->async_lock);
+        client->async_lock = NULL;
     }
     if (client->track_info)
     {
@@ -216,10 +475,9 @@ esp_err_t spotify_client_deinit(esp_spotify_client_handle_t client)
         free(client->track_info);
         client->track_info = NULL;
     }
-    if (client->http_client.handle)
+    for (int i = 0; i < NUM_HOSTS; i++)
     {
-        esp_http_client_cleanup(client->http_client.handle);
-        client->http_client.handle = NULL;
+        http_client_deinit(&client->http[i]);
     }
     if (client->ws_client.handle)
     {
@@ -231,11 +489,6 @@ esp_err_t spotify_client_deinit(esp_spotify_client_handle_t client)
         free(client->ws_client.user_data.buffer);
         client->ws_client.user_data.buffer = NULL;
     }
-    if (client->http_buf_lock)
-    {
-        vSemaphoreDelete(client->http_buf_lock);
-        client->http_buf_lock = NULL;
-    }
     if (client->event_queue)
     {
         vQueueDelete(client->event_queue);
@@ -299,54 +552,35 @@ BaseType_t spotify_wait_event(esp_spotify_client_handle_t client, SpotifyEvent_t
     // maybe we can send the DATA_PROCESSED_EVENT here
 }
 
+esp_err_t spotify_play(esp_spotify_client_handle_t client, const PlayOptions_t *options, HttpStatus_Code *status_code)
+{
+    return send_json(client, HTTP_METHOD_PUT, PLAYERURL(PLAY_TRACK), play_body, options, status_code);
+}
+
 esp_err_t spotify_play_context_uri(esp_spotify_client_handle_t client, const char *uri, HttpStatus_Code *status_code)
 {
-    esp_err_t err;
-    HttpStatus_Code s_code = 0;
-    if (access_token_empty(client))
-    {
-        if ((err = get_access_token(client)) != ESP_OK)
-        {
-            if (status_code)
-            {
-                *status_code = s_code;
-            }
-            return err;
-        }
-    }
-    ACQUIRE_LOCK(client->http_buf_lock);
-    int str_len = sprintf(client->sprintf_buf, "{\"context_uri\":\"%s\"}", uri);
-    assert(str_len <= SPRINTF_BUF_SIZE);
-    esp_http_client_set_post_field(client->http_client.handle, client->sprintf_buf, str_len);
-    client->http_client.http_event_cb = json_http_event_cb;
-    prepare_client(client->http_client.handle, client->access_token.value, "application/json", PLAYERURL(PLAY_TRACK), HTTP_METHOD_PUT);
-retry:
-    ESP_LOGD(TAG, "Endpoint to send: %s", PLAYERURL(PLAY_TRACK));
-    if ((err = esp_http_client_perform(client->http_client.handle)) == ESP_OK)
-    {
-        client->s_retries = 0;
-        HttpStatus_Code s_code = esp_http_client_get_status_code(client->http_client.handle);
-        int length = esp_http_client_get_content_length(client->http_client.handle);
-        ESP_LOGD(TAG, "HTTP Status Code = %d, content_length = %d", s_code, length);
-        ESP_LOGD(TAG, "%s", client->http_client.user_data.buffer);
-        esp_http_client_set_post_field(client->http_client.handle, NULL, 0);
-    }
-    else if (http_retries_available(client, err) == ESP_OK)
-    {
-        goto retry;
-    }
-    if (status_code)
-    {
-        *status_code = s_code;
-    }
-    esp_http_client_close(client->http_client.handle);
-    RELEASE_LOCK(client->http_buf_lock);
-    return err;
+    PlayOptions_t options = { .context_uri = uri };
+    return spotify_play(client, &options, status_code);
+}
+
+esp_err_t spotify_transfer_playback(esp_spotify_client_handle_t client, const char *const *device_ids, int num_ids, bool play, HttpStatus_Code *status_code)
+{
+    IdsBody_t body = { .name = "device_ids", .ids = device_ids, .num_ids = num_ids, .play = play };
+    return send_json(client, HTTP_METHOD_PUT, PLAYERURL(PLAYER), ids_body, &body, status_code);
+}
+
+esp_err_t spotify_save_tracks(esp_spotify_client_handle_t client, const char *const *ids, int num_ids, HttpStatus_Code *status_code)
+{
+    return edit_library(client, HTTP_METHOD_PUT, ids, num_ids, status_code);
+}
+
+esp_err_t spotify_remove_saved_tracks(esp_spotify_client_handle_t client, const char *const *ids, int num_ids, HttpStatus_Code *status_code)
+{
+    return edit_library(client, HTTP_METHOD_DELETE, ids, num_ids, status_code);
 }
 
 List *spotify_user_playlists(esp_spotify_client_handle_t client)
 {
-    esp_err_t err;
     List *playlists = calloc(1, sizeof(List));
     if (!playlists)
     {
@@ -354,47 +588,17 @@ List *spotify_user_playlists(esp_spotify_client_handle_t client)
         return NULL;
     }
     playlists->type = PLAYLIST_LIST;
-    if (access_token_empty(client))
-    {
-        ESP_ERROR_CHECK(get_access_token(client));
-    }
-    ACQUIRE_LOCK(client->http_buf_lock);
-    client->http_client.user_data.ctx = playlists; // pass the playlists as context to event handler
-    client->http_client.http_event_cb = playlist_http_event_cb;
-    prepare_client(client->http_client.handle, client->access_token.value, "application/json", PLAYERURL("/me/playlists?offset=0&limit=50"), HTTP_METHOD_GET);
-retry:
-    ESP_LOGD(TAG, "Endpoint to send: %s", PLAYERURL("/me/playlists?offset=0&limit=50"));
-    if ((err = esp_http_client_perform(client->http_client.handle)) == ESP_OK)
-    {
-        client->s_retries = 0;
-        HttpStatus_Code status_code = esp_http_client_get_status_code(client->http_client.handle);
-        int length = esp_http_client_get_content_length(client->http_client.handle);
-        ESP_LOGD(TAG, "HTTP Status Code = %d, content_length = %d", status_code, length);
-        if (status_code != HttpStatus_Ok)
-        {
-            ESP_LOGE(TAG, "Error. HTTP Status Code = %d", status_code);
-            free(playlists);
-            playlists = NULL;
-        }
-    }
-    else if (http_retries_available(client, err) == ESP_OK)
-    {
-        goto retry;
-    }
-    else
+    if ((access_token_empty(client) && get_access_token(client) != ESP_OK)
+        || submit_request(client, REQ_BULK, playlists_request, playlists) != ESP_OK)
     {
         free(playlists);
         playlists = NULL;
     }
-    client->http_client.user_data.ctx = NULL;
-    esp_http_client_close(client->http_client.handle);
-    RELEASE_LOCK(client->http_buf_lock);
     return playlists;
 }
 
 List *spotify_available_devices(esp_spotify_client_handle_t client)
 {
-    esp_err_t err;
     List *devices = calloc(1, sizeof(List));
     if (!devices)
     {
@@ -402,45 +606,99 @@ List *spotify_available_devices(esp_spotify_client_handle_t client)
         return NULL;
     }
     devices->type = DEVICE_LIST;
-    if (access_token_empty(client))
+    if ((access_token_empty(client) && get_access_token(client) != ESP_OK)
+        || submit_request(client, REQ_REFRESH, devices_request, devices) != ESP_OK)
     {
-        ESP_ERROR_CHECK(get_access_token(client));
+        free(devices);
+        devices = NULL;
     }
-    ACQUIRE_LOCK(client->http_buf_lock);
-    client->http_client.http_event_cb = json_http_event_cb;
-    prepare_client(client->http_client.handle, client->access_token.value, "application/json", PLAYERURL(PLAYER "/devices"), HTTP_METHOD_GET);
-retry:
-    ESP_LOGD(TAG, "Endpoint to send: %s", PLAYERURL(PLAYER "/devices"));
-    if ((err = esp_http_client_perform(client->http_client.handle)) == ESP_OK)
+    return devices;
+}
+
+spotify_request_handle_t spotify_user_playlists_async(esp_spotify_client_handle_t client, TickType_t timeout, spotify_request_cb_t cb, void *user_ctx)
+{
+    return async_submit(client, REQ_BULK, async_new(ASYNC_PLAYLISTS, NULL, timeout, cb, user_ctx));
+}
+
+spotify_request_handle_t spotify_available_devices_async(esp_spotify_client_handle_t client, TickType_t timeout, spotify_request_cb_t cb, void *user_ctx)
+{
+    return async_submit(client, REQ_REFRESH, async_new(ASYNC_DEVICES, NULL, timeout, cb, user_ctx));
+}
+
+spotify_request_handle_t spotify_play_context_uri_async(esp_spotify_client_handle_t client, const char *uri, TickType_t timeout, spotify_request_cb_t cb, void *user_ctx)
+{
+    spotify_request_handle_t req = async_new(ASYNC_PLAY, uri, timeout, cb, user_ctx);
+    if (req)
     {
-        client->s_retries = 0;
-        HttpStatus_Code status_code = esp_http_client_get_status_code(client->http_client.handle);
-        int length = esp_http_client_get_content_length(client->http_client.handle);
-        ESP_LOGD(TAG, "HTTP Status Code = %d, content_length = %d", status_code, length);
-        if (status_code == HttpStatus_Ok)
-        {
-            ESP_LOGD(TAG, "Active devices:\n%s", client->http_client.user_data.buffer);
-            parse_available_devices((char *)(client->http_client.user_data.buffer), devices);
-        }
-        else
-        {
-            ESP_LOGE(TAG, "Error. HTTP Status Code = %d", status_code);
-            free(devices);
-            devices = NULL;
-        }
+        req->options = (PlayOptions_t){ .context_uri = req->str };
+        req->json = (JsonRequest_t){ .method = HTTP_METHOD_PUT, .url = PLAYERURL(PLAY_TRACK), .body = play_body, .arg = &req->options };
     }
-    else if (http_retries_available(client, err) == ESP_OK)
+    return async_submit(client, REQ_INTERACTIVE, req);
+}
+
+spotify_request_handle_t fetch_album_art_async(esp_spotify_client_handle_t client, TrackInfo *track, uint8_t *out_buf, size_t buf_size, TickType_t timeout, spotify_request_cb_t cb, void *user_ctx)
+{
+    if (!out_buf || !track->album.url_cover)
     {
-        goto retry;
+        ESP_LOGE(TAG, "Invalid buffer or no cover url");
+        return NULL;
     }
-    else
+    // the track may change before the request is sent, its url is copied
+    spotify_request_handle_t req = async_new(ASYNC_COVER, track->album.url_cover, timeout, cb, user_ctx);
+    if (req)
     {
-        free(devices);
-        devices = NULL;
+        req->cover = (CoverRequest_t){ .url = req->str, .out_buf = out_buf, .buf_size = buf_size, .data_read = ESP_FAIL };
     }
-    esp_http_client_close(client->http_client.handle);
-    RELEASE_LOCK(client->http_buf_lock);
-    return devices;
+    return async_submit(client, REQ_BULK, req);
+}
+
+bool spotify_request_wait(spotify_request_handle_t req, SpotifyResult_t *result, TickType_t xTicksToWait)
+{
+    if (xSemaphoreTake(req->request.done, xTicksToWait) != pdTRUE)
+    {
+        return false;
+    }
+    // given back, the request stays complete for the next call
+    xSemaphoreGive(req->request.done);
+    if (result)
+    {
+        *result = req->result;
+    }
+    return true;
+}
+
+esp_err_t spotify_request_cancel(esp_spotify_client_handle_t client, spotify_request_handle_t req)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    ACQUIRE_LOCK(client->async_lock);
+    for (spotify_request_handle_t node = client->pending; node; node = node->next)
+    {
+        if (node == req)
+        {
+            // seen by the worker before the request is sent, and on every
+            // chunk of its response
+            req->request.cancelled = true;
+            err = ESP_OK;
+            break;
+        }
+    }
+    RELEASE_LOCK(client->async_lock);
+    return err;
+}
+
+void spotify_set_request_timeout(esp_spotify_client_handle_t client, TickType_t timeout)
+{
+    client->request_timeout = timeout;
+}
+
+void spotify_request_free(spotify_request_handle_t req)
+{
+    if (!req)
+    {
+        return;
+    }
+    xSemaphoreTake(req->request.done, portMAX_DELAY);
+    async_free(req);
 }
 
 void spotify_clear_track(TrackInfo *track)
@@ -456,6 +714,26 @@ void spotify_clear_track(TrackInfo *track)
     track->duration_ms = 0;
 }
 
+void spotify_conn_stats(esp_spotify_client_handle_t client, SpotifyConnStats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < NUM_HOSTS; i++)
+    {
+        HttpClient_t *http = &client->http[i];
+        ACQUIRE_LOCK(http->lock);
+        stats->requests += http->stats.requests;
+        stats->connects += http->stats.connects;
+        stats->reconnects += http->stats.reconnects;
+        stats->full_handshakes += http->stats.full_handshakes;
+        stats->session_offers += http->stats.session_offers;
+        stats->retries += http->stats.retries;
+        stats->rate_limited += http->stats.rate_limited;
+        stats->breaker_trips += http->stats.breaker_trips;
+        stats->fast_failures += http->stats.fast_failures;
+        RELEASE_LOCK(http->lock);
+    }
+}
+
 esp_err_t spotify_clone_track(TrackInfo *dest, const TrackInfo *src)
 {
     strcpy(dest->id, src->id);
@@ -487,14 +765,19 @@ static void player_task(void *pvParameters)
     SpotifyEvent_t spotify_evt;
     EventBits_t uxBits;
     int player_bits = DO_PLAY | DO_PAUSE | DO_PREVIOUS | DO_NEXT | DO_PAUSE_UNPAUSE;
+    int wait_bits = ENABLE_PLAYER | DISABLE_PLAYER | WS_DATA_EVENT | WS_DISCONNECT_EVENT | WS_DATA_CONSUMED | player_bits;
+    bool retry = false; // the player failed to start, it's started again at retry_at
+    TickType_t retry_at = 0;
+    // dealer messages and the hello, without it they're parsed from the heap
+    parse_objects_attach(SMALL_POOL_TOKENS);
     while (1)
     {
-        uxBits = xEventGroupWaitBits(
-            client->ws_client.event_group,
-            ENABLE_PLAYER | DISABLE_PLAYER | WS_DATA_EVENT | WS_DISCONNECT_EVENT | WS_DATA_CONSUMED | player_bits,
-            pdTRUE,
-            pdFALSE,
-            portMAX_DELAY);
+        TickType_t wait = portMAX_DELAY;
+        if (retry)
+        {
+            wait = (int32_t)(retry_at - xTaskGetTickCount()) > 0 ? retry_at - xTaskGetTickCount() : 0;
+        }
+        uxBits = xEventGroupWaitBits(client->ws_client.event_group, wait_bits, pdTRUE, pdFALSE, wait) & wait_bits;
 
         if (uxBits & player_bits)
         {
@@ -509,19 +792,19 @@ static void player_task(void *pvParameters)
                 ESP_LOGW(TAG, "Invalid command");
                 continue;
             }
-            HttpStatus_Code s_code;
-            esp_err_t err = player_cmd(client, n, NULL, &s_code);
-            if (err == ESP_OK && s_code == HttpStatus_Unauthorized)
+            CmdRequest_t cmd = { .cmd = n };
+            esp_err_t err = submit_request(client, REQ_INTERACTIVE, cmd_request, &cmd);
+            if (err == ESP_OK && cmd.status_code == HttpStatus_Unauthorized)
             {
                 if ((err = get_access_token(client)) == ESP_OK)
                 {
-                    err = player_cmd(client, n, NULL, &s_code);
+                    err = submit_request(client, REQ_INTERACTIVE, cmd_request, &cmd);
                 }
             }
             // TODO: send error to queue if err == ESP_FAIL
             continue;
         }
-        else if (uxBits & (ENABLE_PLAYER | WS_DISCONNECT_EVENT))
+        else if ((uxBits & (ENABLE_PLAYER | WS_DISCONNECT_EVENT)) || (!uxBits && retry))
         {
             if (uxBits & ENABLE_PLAYER)
             {
@@ -533,41 +816,52 @@ static void player_task(void *pvParameters)
                 enabled = 1;
             }
             first_msg = 1;
-            ESP_ERROR_CHECK(get_access_token(client));
+            retry = false;
             // if there is a device atached to playback,
             // instead of wait for an event from ws, we
             // send a "fake" NEW_TRACK event
-            HttpStatus_Code status_code;
-            ESP_ERROR_CHECK(player_cmd(client, GET_STATE, NULL, &status_code));
-            if (status_code == HttpStatus_Ok)
+            StateRequest_t state = { 0 };
+            esp_err_t err = get_access_token(client);
+            if (err == ESP_OK)
             {
-                // maybe free track??
-                ACQUIRE_LOCK(client->http_buf_lock);
-                spotify_evt = parse_track((char *)(client->http_client.user_data.buffer), &client->track_info, 1);
-                RELEASE_LOCK(client->http_buf_lock);
-                xQueueSend(client->event_queue, &spotify_evt, portMAX_DELAY);
+                err = submit_request(client, REQ_REFRESH, state_request, &state);
             }
-            else if (status_code == 204)
+            HttpStatus_Code status_code = state.status_code;
+            if (err == ESP_OK && status_code != HttpStatus_Ok && status_code != 204)
             {
-                // no device is atached to playback,
-                // fire an event of no device playing
-                spotify_evt.type = NO_PLAYER_ACTIVE;
+                ESP_LOGE(TAG, "Error trying to get player state. Status code: %d", status_code);
+                err = ESP_FAIL;
+            }
+            if (err != ESP_OK)
+            {
+                // a deadline passed, or a host is down: started again once
+                // it would take requests
+                ESP_LOGE(TAG, "Player not started: %s", esp_err_to_name(err));
+                spotify_evt = (SpotifyEvent_t){ .type = PLAYER_ERROR, .err = err };
                 xQueueSend(client->event_queue, &spotify_evt, portMAX_DELAY);
+                retry = true;
+                retry_at = xTaskGetTickCount() + player_retry_wait(client);
+                continue;
+            }
+            if (status_code == HttpStatus_Ok)
+            {
+                xQueueSend(client->event_queue, &state.evt, portMAX_DELAY);
             }
             else
             {
-                ESP_LOGE(TAG, "Error trying to get player state. Status code: %d", status_code);
-                // TODO: send error to queue
-                break;
+                // no device is atached to playback,
+                // fire an event of no device playing
+                spotify_evt = (SpotifyEvent_t){ .type = NO_PLAYER_ACTIVE };
+                xQueueSend(client->event_queue, &spotify_evt, portMAX_DELAY);
             }
 
             // start the ws session
-            char *uri = http_utils_join_string("wss://dealer.spotify.com/?access_token=", 0, client->access_token.value + 7, strlen(client->access_token.value) - 7);
+            char *uri = http_utils_join_string("wss://dealer.spotify.com/?access_token=", 0, access_token(client) + 7, strlen(access_token(client)) - 7);
 
             esp_websocket_client_set_uri(client->ws_client.handle, uri); // TODO: fix, on WebSocket Error
             free(uri);
             esp_websocket_register_events(client->ws_client.handle, WEBSOCKET_EVENT_ANY, default_ws_event_cb, NULL);
-            esp_err_t err = esp_websocket_client_start(client->ws_client.handle);
+            err = esp_websocket_client_start(client->ws_client.handle);
             if (err == ESP_OK)
             {
                 xEventGroupSetBits(client->ws_client.event_group, WS_READY_FOR_DATA);
@@ -580,6 +874,7 @@ static void player_task(void *pvParameters)
         else if (uxBits & DISABLE_PLAYER)
         {
             enabled = 0;
+            retry = false;
             esp_websocket_client_close(client->ws_client.handle, portMAX_DELAY);
         }
         else if (uxBits & WS_DATA_EVENT)
@@ -588,19 +883,63 @@ static void player_task(void *pvParameters)
             // now the ws buff is our
             // analize data of ws event
 
+            // parsed with the tokens of this task, http requests of other
+            // tasks go on meanwhile
+            jparse_ctx_t jctx;
+            const char *buffer = (char *)client->ws_client.user_data.buffer;
             if (first_msg)
             {
                 first_msg = 0;
                 char *conn_id = NULL;
-                parse_connection_id((char *)client->ws_client.user_data.buffer, &conn_id);
-                assert(conn_id);
+                esp_err_t err = parse_json_start(&jctx, buffer);
+                if (err == ESP_OK)
+                {
+                    err = parse_connection_id(&jctx, &conn_id);
+                    parse_json_end(&jctx);
+                }
+                if (err != ESP_OK)
+                {
+                    // no event comes without a confirmed session, a new
+                    // connection gets a new id
+                    ESP_LOGE(TAG, "No connection id: %s, reconnecting", esp_err_to_name(err));
+                    xEventGroupSetBits(client->ws_client.event_group, WS_READY_FOR_DATA);
+                    esp_websocket_client_close(client->ws_client.handle, portMAX_DELAY);
+                    continue;
+                }
                 ESP_LOGD(TAG, "Connection id: '%s'", conn_id);
-                ESP_ERROR_CHECK(confirm_ws_session(client, conn_id));
+                err = submit_request(client, REQ_REFRESH, confirm_ws_session, conn_id);
+                free(conn_id);
                 xEventGroupSetBits(client->ws_client.event_group, WS_READY_FOR_DATA);
+                if (err != ESP_OK)
+                {
+                    // no event comes either, the player starts again once
+                    // the connection is closed, failing fast while the API
+                    // is down
+                    ESP_LOGE(TAG, "Session not confirmed: %s, reconnecting", esp_err_to_name(err));
+                    spotify_evt = (SpotifyEvent_t){ .type = PLAYER_ERROR, .err = err };
+                    xQueueSend(client->event_queue, &spotify_evt, portMAX_DELAY);
+                    esp_websocket_client_close(client->ws_client.handle, portMAX_DELAY);
+                }
             }
             else
             {
-                spotify_evt = parse_track((char *)client->ws_client.user_data.buffer, &client->track_info, 0);
+                // progress updates of the track playing aren't parsed
+                if (parse_same_track(buffer, client->track_info))
+                {
+                    spotify_evt = (SpotifyEvent_t){ .type = SAME_TRACK, .payload = client->track_info };
+                }
+                else
+                {
+                    if (parse_track_start(&jctx, buffer) == ESP_OK)
+                    {
+                        spotify_evt = parse_track(&jctx, &client->track_info, 0);
+                    }
+                    else
+                    {
+                        spotify_evt = (SpotifyEvent_t){ .type = PARSE_ERROR, .err = ESP_ERR_INVALID_RESPONSE };
+                    }
+                    parse_json_end(&jctx);
+                }
                 xQueueSend(client->event_queue, &spotify_evt, portMAX_DELAY);
             }
         }
@@ -612,71 +951,474 @@ static void player_task(void *pvParameters)
     }
 }
 
-static esp_err_t confirm_ws_session(esp_spotify_client_handle_t client, char *conn_id)
+static esp_err_t confirm_ws_session(esp_spotify_client_handle_t client, void *arg)
 {
+    char *conn_id = arg;
     esp_err_t err;
-    ACQUIRE_LOCK(client->http_buf_lock);
-    client->http_client.http_event_cb = json_http_event_cb;
+    HttpClient_t *api = &client->http[HOST_API];
+    ACQUIRE_LOCK(api->lock);
+    api->http_event_cb = json_http_event_cb;
     char *url = http_utils_join_string("https://api.spotify.com/v1/me/notifications/player?connection_id=", 0, conn_id, 0);
-    prepare_client(client->http_client.handle, client->access_token.value, "application/json", url, HTTP_METHOD_PUT);
-retry:
+    prepare_client(api, access_token(client), "application/json", url, HTTP_METHOD_PUT);
     ESP_LOGD(TAG, "Endpoint to send: %s", url);
-    if ((err = esp_http_client_perform(client->http_client.handle)) == ESP_OK)
+    if ((err = http_send(api, NULL, NULL)) == ESP_OK)
     {
-        client->s_retries = 0;
-        HttpStatus_Code status_code = esp_http_client_get_status_code(client->http_client.handle);
-        int length = esp_http_client_get_content_length(client->http_client.handle);
+        HttpStatus_Code status_code = esp_http_client_get_status_code(api->handle);
+        int length = esp_http_client_get_content_length(api->handle);
         ESP_LOGD(TAG, "HTTP Status Code = %d, content_length = %d", status_code, length);
-        free(conn_id);
-        free(url);
         err = (status_code == HttpStatus_Ok) ? ESP_OK : ESP_FAIL;
     }
-    else if (http_retries_available(client, err) == ESP_OK)
+    free(url);
+    RELEASE_LOCK(api->lock);
+    return err;
+}
+
+/* Runs fn on the worker of its class and waits for it to return */
+static esp_err_t submit_request(esp_spotify_client_handle_t client, ReqClass_t cls, request_fn_t fn, void *arg)
+{
+    Request_t req = { .fn = fn, .arg = arg, .err = ESP_FAIL };
+    req.done = xSemaphoreCreateBinaryStatic(&req.done_buf);
+    set_deadline(&req, client->request_timeout);
+    queue_request(client, cls, &req, portMAX_DELAY);
+    xSemaphoreTake(req.done, portMAX_DELAY);
+    vSemaphoreDelete(req.done);
+    return req.err;
+}
+
+static esp_err_t queue_request(esp_spotify_client_handle_t client, ReqClass_t cls, Request_t *req, TickType_t xTicksToWait)
+{
+    if (xQueueSend(client->requests[cls], &req, xTicksToWait) != pdTRUE)
     {
-        goto retry;
+        return ESP_ERR_TIMEOUT;
     }
-    esp_http_client_close(client->http_client.handle);
-    RELEASE_LOCK(client->http_buf_lock);
-    return err;
+    // a notification per request queued, whatever its class
+    xTaskNotifyGive(client->workers[class_worker[cls]].task);
+    return ESP_OK;
 }
 
-static inline esp_err_t http_retries_available(esp_spotify_client_handle_t client, esp_err_t err)
+static void request_worker(void *pvParameters)
 {
-    ESP_LOGE(TAG, "HTTP request failed: %s", esp_err_to_name(err));
-    if (++(client->s_retries) <= RETRIES_ERR_CONN)
+    Worker_t *worker = pvParameters;
+    esp_spotify_client_handle_t client = worker->client;
+    Request_t *req;
+    parse_objects_attach(worker_tokens[worker->id]);
+    while (1)
     {
-        esp_http_client_close(client->http_client.handle);
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        ESP_LOGW(TAG, "Retrying %d/%d...", client->s_retries, RETRIES_ERR_CONN);
-        debug_mem();
-        return ESP_OK;
+        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+        // the highest class first: a command queued behind a refresh is sent
+        // before it
+        for (int cls = 0; cls < NUM_REQ_CLASSES; cls++)
+        {
+            if (class_worker[cls] == worker->id && xQueueReceive(client->requests[cls], &req, 0) == pdTRUE)
+            {
+                worker->current = req;
+                req->aborted = false;
+                req->err = request_expired(req) ? ESP_ERR_TIMEOUT : req->fn(client, req->arg);
+                // fn may have parsed what it read of an aborted response
+                if (req->cancelled)
+                {
+                    req->err = ESP_ERR_INVALID_STATE;
+                }
+                else if (req->aborted || (req->err != ESP_OK && request_expired(req)))
+                {
+                    req->err = ESP_ERR_TIMEOUT;
+                }
+                worker->current = NULL;
+                if (req->complete)
+                {
+                    req->complete(req->arg);
+                }
+                else
+                {
+                    xSemaphoreGive(req->done);
+                }
+                break;
+            }
+        }
     }
-    client->s_retries = 0;
-    return ESP_FAIL;
 }
 
-static esp_err_t http_event_cb_wrapper(esp_http_client_event_t *evt)
+static esp_err_t cmd_request(esp_spotify_client_handle_t client, void *arg)
 {
-    esp_spotify_client_handle_t client = evt->user_data;
-    evt->user_data = &client->http_client.user_data;
-    return client->http_client.http_event_cb(evt);
+    CmdRequest_t *req = arg;
+    return player_cmd(client, req->cmd, NULL, &req->status_code);
 }
 
-static inline void free_track(TrackInfo *track)
+/* The response is parsed here, with the tokens of the worker that received it */
+static esp_err_t state_request(esp_spotify_client_handle_t client, void *arg)
 {
-    if (!track)
+    StateRequest_t *req = arg;
+    HttpClient_t *api = &client->http[HOST_API];
+    esp_err_t err = player_cmd(client, GET_STATE, NULL, &req->status_code);
+    if (err != ESP_OK || req->status_code != HttpStatus_Ok)
     {
-        return;
+        return err;
     }
-    if (track->name)
+    // maybe free track??
+    ACQUIRE_LOCK(api->lock);
+    jparse_ctx_t *jctx = &api->user_data.jctx;
+    if (json_parse_stream_finish(jctx) == OS_SUCCESS)
     {
-        free(track->name);
-        track->name = NULL;
+        req->evt = parse_track(jctx, &client->track_info, 1);
     }
-    if (track->album.name)
+    else
     {
-        free(track->album.name);
-        track->album.name = NULL;
+        ESP_LOGE(TAG, "Invalid player state, status: %d", jctx->stream.status);
+        req->evt = (SpotifyEvent_t){ .type = PARSE_ERROR, .err = ESP_ERR_INVALID_RESPONSE };
+    }
+    parse_json_end(jctx);
+    RELEASE_LOCK(api->lock);
+    return err;
+}
+
+static esp_err_t playlists_request(esp_spotify_client_handle_t client, void *arg)
+{
+    HttpClient_t *bulk = &client->http[HOST_API_BULK];
+    esp_err_t err;
+    ACQUIRE_LOCK(bulk->lock);
+    bulk->user_data.ctx = arg; // pass the playlists as context to event handler
+    prepare_client(bulk, access_token(client), "application/json", PLAYERURL("/me/playlists?offset=0&limit=50"), HTTP_METHOD_GET);
+    ESP_LOGD(TAG, "Endpoint to send: %s", PLAYERURL("/me/playlists?offset=0&limit=50"));
+    if ((err = http_send(bulk, NULL, NULL)) == ESP_OK)
+    {
+        HttpStatus_Code status_code = esp_http_client_get_status_code(bulk->handle);
+        int length = esp_http_client_get_content_length(bulk->handle);
+        ESP_LOGD(TAG, "HTTP Status Code = %d, content_length = %d", status_code, length);
+        if (status_code != HttpStatus_Ok)
+        {
+            ESP_LOGE(TAG, "Error. HTTP Status Code = %d", status_code);
+            err = ESP_FAIL;
+        }
+    }
+    // the second connection to the API is only open while a transfer needs
+    // it, the TLS session saved resumes the next one
+    esp_http_client_close(bulk->handle);
+    bulk->user_data.ctx = NULL;
+    RELEASE_LOCK(bulk->lock);
+    return err;
+}
+
+static esp_err_t devices_request(esp_spotify_client_handle_t client, void *arg)
+{
+    HttpClient_t *api = &client->http[HOST_API];
+    esp_err_t err;
+    ACQUIRE_LOCK(api->lock);
+    api->http_event_cb = json_http_event_cb;
+    prepare_client(api, access_token(client), "application/json", PLAYERURL(PLAYER "/devices"), HTTP_METHOD_GET);
+    ESP_LOGD(TAG, "Endpoint to send: %s", PLAYERURL(PLAYER "/devices"));
+    if ((err = http_send(api, NULL, NULL)) == ESP_OK)
+    {
+        HttpStatus_Code status_code = esp_http_client_get_status_code(api->handle);
+        int length = esp_http_client_get_content_length(api->handle);
+        ESP_LOGD(TAG, "HTTP Status Code = %d, content_length = %d", status_code, length);
+        if (status_code == HttpStatus_Ok && json_parse_stream_finish(&api->user_data.jctx) == OS_SUCCESS)
+        {
+            ESP_LOGD(TAG, "Active devices:\n%s", api->user_data.buffer);
+            // the devices read are returned anyway
+            parse_available_devices(&api->user_data.jctx, arg);
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Error. HTTP Status Code = %d", status_code);
+            err = ESP_FAIL;
+        }
+    }
+    parse_json_end(&api->user_data.jctx);
+    RELEASE_LOCK(api->lock);
+    return err;
+}
+
+static spotify_request_handle_t async_new(AsyncKind_t kind, const char *str, TickType_t timeout, spotify_request_cb_t cb, void *user_ctx)
+{
+    spotify_request_handle_t req = calloc(1, sizeof(*req));
+    if (!req || (str && !(req->str = strdup(str))))
+    {
+        ESP_LOGE(TAG, "Cannot allocate memory for request");
+        free(req);
+        return NULL;
+    }
+    req->request = (Request_t){ .fn = async_request, .arg = req, .err = ESP_FAIL, .complete = async_complete };
+    req->request.done = xSemaphoreCreateBinaryStatic(&req->request.done_buf);
+    set_deadline(&req->request, timeout);
+    req->kind = kind;
+    req->cb = cb;
+    req->user_ctx = user_ctx;
+    req->owner = xTaskGetCurrentTaskHandle();
+    req->result = (SpotifyResult_t){ .err = ESP_FAIL, .data_read = ESP_FAIL };
+    return req;
+}
+
+/* Never waits for room in the queue, the caller mustn't block */
+static spotify_request_handle_t async_submit(esp_spotify_client_handle_t client, ReqClass_t cls, spotify_request_handle_t req)
+{
+    if (!req)
+    {
+        return NULL;
+    }
+    req->client = client;
+    ACQUIRE_LOCK(client->async_lock);
+    req->next = client->pending;
+    client->pending = req;
+    RELEASE_LOCK(client->async_lock);
+    if (queue_request(client, cls, &req->request, 0) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Too many requests waiting");
+        async_unlist(client, req);
+        async_free(req);
+        req = NULL;
+    }
+    return req;
+}
+
+/* What the blocking functions do, the token included, on the worker */
+static esp_err_t async_request(esp_spotify_client_handle_t client, void *arg)
+{
+    spotify_request_handle_t req = arg;
+    SpotifyResult_t *result = &req->result;
+    esp_err_t err = ESP_OK;
+    if (req->kind != ASYNC_COVER && access_token_empty(client))
+    {
+        err = get_access_token(client);
+    }
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    switch (req->kind)
+    {
+    case ASYNC_PLAYLISTS:
+    case ASYNC_DEVICES:
+        if (!(result->list = calloc(1, sizeof(List))))
+        {
+            err = ESP_ERR_NO_MEM;
+            break;
+        }
+        if (req->kind == ASYNC_PLAYLISTS)
+        {
+            result->list->type = PLAYLIST_LIST;
+            err = playlists_request(client, result->list);
+        }
+        else
+        {
+            result->list->type = DEVICE_LIST;
+            err = devices_request(client, result->list);
+        }
+        if (err != ESP_OK)
+        {
+            // a cancelled download leaves some
+            spotify_free_nodes(result->list);
+            free(result->list);
+            result->list = NULL;
+        }
+        break;
+    case ASYNC_PLAY:
+        err = json_request(client, &req->json);
+        result->status_code = req->json.status_code;
+        break;
+    case ASYNC_COVER:
+        err = cover_request(client, &req->cover);
+        result->data_read = req->cover.data_read;
+        break;
+    }
+    return err;
+}
+
+static void async_complete(void *arg)
+{
+    spotify_request_handle_t req = arg;
+    // the worker's error, that of the deadline or the cancellation included
+    req->result.err = req->request.err;
+    async_unlist(req->client, req);
+    if (req->cb)
+    {
+        req->cb(req, &req->result, req->user_ctx);
+        async_free(req);
+        return;
+    }
+    // the owner may free the request as soon as done is given
+    TaskHandle_t owner = req->owner;
+    xSemaphoreGive(req->request.done);
+    xTaskNotifyGive(owner);
+}
+
+static void async_free(spotify_request_handle_t req)
+{
+    vSemaphoreDelete(req->request.done);
+    free(req->str);
+    free(req);
+}
+
+static void async_unlist(esp_spotify_client_handle_t client, spotify_request_handle_t req)
+{
+    ACQUIRE_LOCK(client->async_lock);
+    for (spotify_request_handle_t *node = &client->pending; *node; node = &(*node)->next)
+    {
+        if (*node == req)
+        {
+            *node = req->next;
+            break;
+        }
+    }
+    RELEASE_LOCK(client->async_lock);
+}
+
+/* portMAX_DELAY for none, as with FreeRTOS */
+static void set_deadline(Request_t *req, TickType_t timeout)
+{
+    req->has_deadline = timeout != portMAX_DELAY;
+    req->deadline = xTaskGetTickCount() + timeout;
+}
+
+static bool request_expired(const Request_t *req)
+{
+    return req->cancelled || (req->has_deadline && (int32_t)(xTaskGetTickCount() - req->deadline) >= 0);
+}
+
+/* The request run by the calling task, NULL if it isn't a worker */
+static Request_t *current_request(esp_spotify_client_handle_t client)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < NUM_WORKERS; i++)
+    {
+        if (client->workers[i].task == task)
+        {
+            return client->workers[i].current;
+        }
+    }
+    return NULL;
+}
+
+/* Exponential, half of it random: devices rate limited together don't
+ * retry in lockstep */
+static TickType_t retry_delay(int attempt)
+{
+    uint32_t ms = RETRY_BASE_MS << attempt;
+    if (ms > RETRY_MAX_MS)
+    {
+        ms = RETRY_MAX_MS;
+    }
+    return pdMS_TO_TICKS(ms / 2 + esp_random() % (ms / 2 + 1));
+}
+
+/* false if the request would be past its deadline, or is cancelled meanwhile */
+static bool retry_wait(Request_t *req, TickType_t wait)
+{
+    if (req && req->has_deadline && (int32_t)(req->deadline - xTaskGetTickCount() - wait) <= 0)
+    {
+        return false;
+    }
+    while (wait > 0)
+    {
+        TickType_t slice = wait < pdMS_TO_TICKS(100) ? wait : pdMS_TO_TICKS(100);
+        vTaskDelay(slice);
+        wait -= slice;
+        if (req && request_expired(req))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool breaker_tripped(HttpClient_t *http)
+{
+    return http->tripped && (int32_t)(http->tripped_until - xTaskGetTickCount()) > 0;
+}
+
+/* Until the hosts the player starts with would take requests again */
+static TickType_t player_retry_wait(esp_spotify_client_handle_t client)
+{
+    static const Host_t hosts[] = { HOST_API, HOST_TOKEN };
+    TickType_t wait = pdMS_TO_TICKS(PLAYER_RETRY_MS);
+    for (int i = 0; i < sizeof(hosts) / sizeof(hosts[0]); i++)
+    {
+        HttpClient_t *http = &client->http[hosts[i]];
+        if (breaker_tripped(http) && (TickType_t)(http->tripped_until - xTaskGetTickCount()) > wait)
+        {
+            wait = http->tripped_until - xTaskGetTickCount();
+        }
+    }
+    return wait;
+}
+
+/* The host trips once BREAKER_THRESHOLD attempts failed in a row, or when it
+ * asks to hold the requests (Retry-After). Once that's over, the next request
+ * is sent: it closes the breaker, or trips it again if it fails */
+static void breaker_failure(HttpClient_t *http, TickType_t hold)
+{
+    if (++(http->failures) >= BREAKER_THRESHOLD && hold < pdMS_TO_TICKS(BREAKER_COOLDOWN_MS))
+    {
+        hold = pdMS_TO_TICKS(BREAKER_COOLDOWN_MS);
+    }
+    if (hold)
+    {
+        if (!breaker_tripped(http))
+        {
+            http->stats.breaker_trips++;
+        }
+        http->tripped = true;
+        http->tripped_until = xTaskGetTickCount() + hold;
+    }
+}
+
+static esp_err_t http_event_cb_wrapper(esp_http_client_event_t *evt)
+{
+    HttpClient_t *http = evt->user_data;
+    switch (evt->event_id)
+    {
+    case HTTP_EVENT_ON_CONNECTED:
+        http->connected = true;
+        http->stats.connects++;
+        count_handshake(http);
+        break;
+    case HTTP_EVENT_ON_HEADER:
+        http->responded = true;
+        if (strcasecmp(evt->header_key, "Retry-After") == 0)
+        {
+            // in seconds, the HTTP date form isn't used by Spotify
+            http->retry_after_ms = atoi(evt->header_value) * 1000;
+        }
+        break;
+    case HTTP_EVENT_ON_DATA:
+    {
+        Request_t *req = current_request(http->client);
+        if (req && request_expired(req))
+        {
+            // closes the connection, esp_http_client_perform() returns
+            // without reading the rest
+            ESP_LOGD(TAG, "Request %s, aborting", req->cancelled ? "cancelled" : "past its deadline");
+            req->aborted = true;
+            esp_http_client_cancel_request(evt->client);
+            http->connected = false;
+            return ESP_OK;
+        }
+        break;
+    }
+    case HTTP_EVENT_DISCONNECTED:
+        http->connected = false;
+        break;
+    default:
+        break;
+    }
+    evt->user_data = &http->user_data;
+    return http->http_event_cb(evt);
+}
+
+static inline void free_track(TrackInfo *track)
+{
+    if (!track)
+    {
+        return;
+    }
+    if (track->name)
+    {
+        free(track->name);
+        track->name = NULL;
+    }
+    if (track->album.name)
+    {
+        free(track->album.name);
+        track->album.name = NULL;
     }
     if (track->album.url_cover)
     {
@@ -720,37 +1462,40 @@ static inline void debug_mem()
 
 ssize_t fetch_album_art(esp_spotify_client_handle_t client, TrackInfo *track, uint8_t *out_buf, size_t buf_size)
 {
+    CoverRequest_t req = { .url = track->album.url_cover, .out_buf = out_buf, .buf_size = buf_size, .data_read = ESP_FAIL };
     if (!out_buf)
     {
         ESP_LOGE(TAG, "Invalid buffer");
         return ESP_FAIL;
     }
+    submit_request(client, REQ_BULK, cover_request, &req);
+    return req.data_read;
+}
 
-    ACQUIRE_LOCK(client->http_buf_lock);
-    if (!track->album.url_cover)
+static esp_err_t cover_request(esp_spotify_client_handle_t client, void *arg)
+{
+    CoverRequest_t *req = arg;
+    HttpClient_t *images = &client->http[HOST_IMAGES];
+    ACQUIRE_LOCK(images->lock);
+    if (!req->url)
     {
         ESP_LOGE(TAG, "No cover url");
-        RELEASE_LOCK(client->http_buf_lock);
+        RELEASE_LOCK(images->lock);
         return ESP_FAIL;
     }
-    uint8_t *buff_backup = client->http_client.user_data.buffer;
-    size_t buff_size_backup = client->http_client.user_data.buffer_size;
-    client->http_client.http_event_cb = default_http_event_cb;
-    prepare_client(client->http_client.handle, NULL, NULL, track->album.url_cover, HTTP_METHOD_GET);
-    client->http_client.user_data.buffer = out_buf;
-    client->http_client.user_data.buffer_size = buf_size;
+    prepare_client(images, NULL, NULL, req->url, HTTP_METHOD_GET);
+    images->user_data.buffer = req->out_buf;
+    images->user_data.buffer_size = req->buf_size;
     esp_err_t err;
     ssize_t data_read = ESP_FAIL;
 
-retry:
-    ESP_LOGD(TAG, "Endpoint to send: %s", track->album.url_cover);
-    if ((err = esp_http_client_perform(client->http_client.handle)) == ESP_OK)
+    ESP_LOGD(TAG, "Endpoint to send: %s", req->url);
+    if ((err = http_send(images, NULL, NULL)) == ESP_OK)
     {
-        client->s_retries = 0;
-        HttpStatus_Code status_code = esp_http_client_get_status_code(client->http_client.handle);
-        int64_t length = esp_http_client_get_content_length(client->http_client.handle);
+        HttpStatus_Code status_code = esp_http_client_get_status_code(images->handle);
+        int64_t length = esp_http_client_get_content_length(images->handle);
         ESP_LOGD(TAG, "HTTP Status Code = %d, content_length = %" PRId64, status_code, length);
-        if (length > buf_size)
+        if (length > req->buf_size)
         {
             ESP_LOGE(TAG, "Image too big");
         }
@@ -760,39 +1505,67 @@ retry:
         }
         else
         {
-            data_read = client->http_client.user_data.current_size;
+            data_read = images->user_data.current_size;
         }
     }
-    else if (http_retries_available(client, err) == ESP_OK)
+    // covers come once per track, the TLS session saved resumes the next
+    // connection
+    esp_http_client_close(images->handle);
+    images->user_data.buffer = NULL;
+    images->user_data.buffer_size = 0;
+    RELEASE_LOCK(images->lock);
+    req->data_read = data_read;
+    return data_read < 0 ? ESP_FAIL : ESP_OK;
+}
+
+/* Fetched on the bulk worker, the response is parsed there too. Single
+ * flight: the tasks that ask for a token while one is being fetched wait
+ * for that one and get it, its error if it failed, without fetching another */
+static esp_err_t get_access_token(esp_spotify_client_handle_t client)
+{
+    uint32_t fetches = client->access_token.fetches;
+    if (client->workers[WORKER_BULK].task == xTaskGetCurrentTaskHandle())
     {
-        goto retry;
+        return fetch_access_token(client, fetches);
     }
-    esp_http_client_close(client->http_client.handle);
-    // restore the buffer
-    client->http_client.user_data.buffer = buff_backup;
-    client->http_client.user_data.buffer_size = buff_size_backup;
-    RELEASE_LOCK(client->http_buf_lock);
-    return data_read;
+    return submit_request(client, REQ_TOKEN, token_request, &fetches);
 }
 
-static esp_err_t get_access_token(esp_spotify_client_handle_t client)
+static esp_err_t token_request(esp_spotify_client_handle_t client, void *arg)
+{
+    return fetch_access_token(client, *(uint32_t *)arg);
+}
+
+/* fetches is the count of fetches completed when the token was asked for */
+static esp_err_t fetch_access_token(esp_spotify_client_handle_t client, uint32_t fetches)
 {
+    HttpClient_t *token = &client->http[HOST_TOKEN];
+    char value[ACCESS_TOKEN_SIZE - 7];
+    int expires_in;
     esp_err_t err;
-    ACQUIRE_LOCK(client->http_buf_lock);
-    client->http_client.http_event_cb = json_http_event_cb;
-    prepare_client(client->http_client.handle, CONFIG_DISCORD_TOKEN, "application/json", ACCESS_TOKEN_URL, HTTP_METHOD_GET);
-retry:
+    ACQUIRE_LOCK(token->lock);
+    if (client->access_token.fetches != fetches)
+    {
+        err = client->access_token.fetch_err;
+        RELEASE_LOCK(token->lock);
+        ESP_LOGD(TAG, "Access token fetched meanwhile: %s", esp_err_to_name(err));
+        return err;
+    }
+    prepare_client(token, CONFIG_DISCORD_TOKEN, "application/json", ACCESS_TOKEN_URL, HTTP_METHOD_GET);
     ESP_LOGD(TAG, "Endpoint to send: %s", ACCESS_TOKEN_URL);
-    if ((err = esp_http_client_perform(client->http_client.handle)) == ESP_OK)
+    if ((err = http_send(token, NULL, NULL)) == ESP_OK)
     {
-        client->s_retries = 0;
-        HttpStatus_Code status_code = esp_http_client_get_status_code(client->http_client.handle);
-        int length = esp_http_client_get_content_length(client->http_client.handle);
+        HttpStatus_Code status_code = esp_http_client_get_status_code(token->handle);
+        int length = esp_http_client_get_content_length(token->handle);
         ESP_LOGD(TAG, "HTTP Status Code = %d, content_length = %d", status_code, length);
-        if (status_code == HttpStatus_Ok)
+        if (status_code == HttpStatus_Ok && json_parse_stream_finish(&token->user_data.jctx) == OS_SUCCESS)
         {
-            parse_access_token((char *)(client->http_client.user_data.buffer), client->access_token.value + 7, 400 - 7);
-            ESP_LOGD(TAG, "Access Token obtained:\n%s", &(client->access_token.value[7]));
+            if ((err = parse_access_token(&token->user_data.jctx, value, sizeof(value), &expires_in)) == ESP_OK)
+            {
+                set_access_token(client, value);
+                schedule_refresh(client, expires_in);
+                ESP_LOGD(TAG, "Access Token obtained:\n%s", value);
+            }
         }
         else
         {
@@ -800,21 +1573,22 @@ retry:
             err = ESP_FAIL;
         }
     }
-    else if (http_retries_available(client, err) == ESP_OK)
-    {
-        goto retry;
-    }
-    esp_http_client_close(client->http_client.handle);
-    RELEASE_LOCK(client->http_buf_lock);
+    parse_json_end(&token->user_data.jctx);
+    // a token lasts an hour, its connection isn't kept that long
+    esp_http_client_close(token->handle);
+    client->access_token.fetch_err = err;
+    client->access_token.fetches++;
+    RELEASE_LOCK(token->lock);
     return err;
 }
 
 // ok
 static esp_err_t player_cmd(esp_spotify_client_handle_t client, PlayerCommand_t cmd, void *payload, HttpStatus_Code *status_code)
 {
+    HttpClient_t *api = &client->http[HOST_API];
     esp_err_t err;
     HttpStatus_Code s_code = 0;
-    ACQUIRE_LOCK(client->http_buf_lock);
+    ACQUIRE_LOCK(api->lock);
     esp_http_client_method_t method = HTTP_METHOD_GET;
     const char *url = NULL;
     switch (cmd)
@@ -859,26 +1633,21 @@ static esp_err_t player_cmd(esp_spotify_client_handle_t client, PlayerCommand_t
         {
             *status_code = s_code;
         }
-        RELEASE_LOCK(client->http_buf_lock);
+        RELEASE_LOCK(api->lock);
         return err;
     }
-    client->http_client.http_event_cb = json_http_event_cb;
-    prepare_client(client->http_client.handle, client->access_token.value, "application/json", url, method);
+    api->http_event_cb = json_http_event_cb;
+    prepare_client(api, access_token(client), "application/json", url, method);
 
 retry:
     ESP_LOGD(TAG, "Endpoint to send: %s", url);
-    if ((err = esp_http_client_perform(client->http_client.handle)) == ESP_OK)
+    if ((err = http_send(api, NULL, NULL)) == ESP_OK)
     {
-        client->s_retries = 0;
-        s_code = esp_http_client_get_status_code(client->http_client.handle);
-        int length = esp_http_client_get_content_length(client->http_client.handle);
+        s_code = esp_http_client_get_status_code(api->handle);
+        int length = esp_http_client_get_content_length(api->handle);
         ESP_LOGD(TAG, "HTTP Status Code = %d, content_length = %d", s_code, length);
-        ESP_LOGD(TAG, "%s", client->http_client.user_data.buffer);
-        ESP_LOGD(TAG, "curr size %d", client->http_client.user_data.current_size);
-    }
-    else if (http_retries_available(client, err) == ESP_OK)
-    {
-        goto retry;
+        ESP_LOGD(TAG, "%s", api->user_data.buffer);
+        ESP_LOGD(TAG, "curr size %d", api->user_data.current_size);
     }
     if (status_code)
     {
@@ -896,22 +1665,413 @@ retry:
             {
                 url = PLAYERURL(PAUSE_TRACK);
             }
-            esp_http_client_set_url(client->http_client.handle, url);
+            esp_http_client_set_url(api->handle, url);
             goto retry;
         }
     }
-    esp_http_client_close(client->http_client.handle);
-    RELEASE_LOCK(client->http_buf_lock);
+    RELEASE_LOCK(api->lock);
+    return err;
+}
+
+/* Request with a JSON body, see http_perform_json() */
+static esp_err_t send_json(esp_spotify_client_handle_t client, esp_http_client_method_t method, const char *url, json_body_cb_t body, const void *arg, HttpStatus_Code *status_code)
+{
+    JsonRequest_t req = { .method = method, .url = url, .body = body, .arg = arg };
+    esp_err_t err = ESP_OK;
+    if (!access_token_empty(client) || (err = get_access_token(client)) == ESP_OK)
+    {
+        err = submit_request(client, REQ_INTERACTIVE, json_request, &req);
+    }
+    if (status_code)
+    {
+        *status_code = req.status_code;
+    }
+    return err;
+}
+
+static esp_err_t json_request(esp_spotify_client_handle_t client, void *arg)
+{
+    JsonRequest_t *req = arg;
+    HttpClient_t *api = &client->http[HOST_API];
+    esp_err_t err;
+    ACQUIRE_LOCK(api->lock);
+    api->http_event_cb = json_http_event_cb;
+    prepare_client(api, access_token(client), "application/json", req->url, req->method);
+    ESP_LOGD(TAG, "Endpoint to send: %s", req->url);
+    if ((err = http_send(api, req->body, req->arg)) == ESP_OK)
+    {
+        req->status_code = esp_http_client_get_status_code(api->handle);
+        int length = esp_http_client_get_content_length(api->handle);
+        ESP_LOGD(TAG, "HTTP Status Code = %d, content_length = %d", req->status_code, length);
+        ESP_LOGD(TAG, "%s", api->user_data.buffer);
+    }
+    RELEASE_LOCK(api->lock);
     return err;
 }
 
+/* Sends the request prepared on the client. An attempt that fails, or is rate
+ * limited (429, 503), is retried up to RETRIES_ERR_CONN times, after an
+ * exponential backoff or the Retry-After of the response. The retries are the
+ * request's own; the breaker, that fails fast while the host is down, is
+ * shared by all the requests to it */
+static esp_err_t http_send(HttpClient_t *http, json_body_cb_t body, const void *arg)
+{
+    Request_t *req = current_request(http->client);
+    if (breaker_tripped(http))
+    {
+        ESP_LOGW(TAG, "%.*s is failing, request not sent", http->host_len, http->host);
+        http->stats.fast_failures++;
+        return ESP_ERR_HTTP_CONNECT;
+    }
+    for (int attempt = 0;; attempt++)
+    {
+        esp_err_t err = http_attempt(http, req, body, arg);
+        if (req && (req->aborted || request_expired(req)))
+        {
+            // the response may be cut short even if the client returned
+            // ESP_OK, and the host isn't to blame
+            return ESP_ERR_TIMEOUT;
+        }
+        int status = (err == ESP_OK) ? esp_http_client_get_status_code(http->handle) : 0;
+        bool limited = (status == HTTP_TOO_MANY_REQUESTS || status == HTTP_SERVICE_UNAVAILABLE);
+        if (err == ESP_OK && !limited)
+        {
+            http->failures = 0;
+            http->tripped = false;
+            return ESP_OK;
+        }
+        if (limited)
+        {
+            http->stats.rate_limited++;
+            ESP_LOGW(TAG, "Rate limited, status %d, Retry-After: %d ms", status, http->retry_after_ms);
+            breaker_failure(http, http->retry_after_ms > 0 ? pdMS_TO_TICKS(http->retry_after_ms) : 0);
+        }
+        else
+        {
+            ESP_LOGE(TAG, "HTTP request failed: %s", esp_err_to_name(err));
+            esp_http_client_close(http->handle);
+            breaker_failure(http, 0);
+        }
+        TickType_t wait = retry_delay(attempt);
+        if (breaker_tripped(http) && (TickType_t)(http->tripped_until - xTaskGetTickCount()) > wait)
+        {
+            wait = http->tripped_until - xTaskGetTickCount();
+        }
+        if (attempt == RETRIES_ERR_CONN || wait > pdMS_TO_TICKS(RETRY_MAX_MS) || !retry_wait(req, wait))
+        {
+            // a rate limited response is left to the caller, with its status
+            return err;
+        }
+        http->stats.retries++;
+        ESP_LOGW(TAG, "Retrying %d/%d...", attempt + 1, RETRIES_ERR_CONN);
+        debug_mem();
+    }
+}
+
+/* One attempt, on the connection kept from the last request if it's still
+ * open. The server may have closed it meanwhile, which only shows once it's
+ * used: a request failing that way, before any response, is sent again right
+ * away on a new connection */
+static esp_err_t http_attempt(HttpClient_t *http, Request_t *req, json_body_cb_t body, const void *arg)
+{
+    esp_http_client_handle_t handle = http->handle;
+    int timeout_ms = HTTP_TIMEOUT_MS;
+    if (req && request_expired(req))
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+    if (req && req->has_deadline)
+    {
+        // what's left of it bounds the connection and each read
+        int left_ms = pdTICKS_TO_MS(req->deadline - xTaskGetTickCount());
+        if (left_ms < timeout_ms)
+        {
+            timeout_ms = left_ms;
+        }
+    }
+    esp_http_client_set_timeout_ms(handle, timeout_ms);
+    bool reused = http->connected;
+    http->responded = false;
+    http->retry_after_ms = -1;
+    http->stats.requests++;
+    esp_err_t err = body ? http_perform_json(handle, body, arg) : esp_http_client_perform(handle);
+    if (err != ESP_OK && reused && !http->responded && !(req && request_expired(req)))
+    {
+        ESP_LOGD(TAG, "Kept connection closed by the server: %s, reconnecting", esp_err_to_name(err));
+        esp_http_client_close(handle);
+        http->stats.requests++;
+        http->stats.reconnects++;
+        err = body ? http_perform_json(handle, body, arg) : esp_http_client_perform(handle);
+    }
+    return err;
+}
+
+/* esp_http_client keeps the TLS session of its last connection only and
+ * offers it on the next one, whatever the host: it may be resumed when the
+ * host is the same, as it always is but for covers on another CDN. Whether
+ * the server accepted it isn't exposed, so the offers are counted; without
+ * one the handshake is a full one */
+static void count_handshake(HttpClient_t *http)
+{
+    const char *host = http->host;
+    int len = http->host_len;
+    char *session_host = http->session_host;
+#ifdef CONFIG_SPOTIFY_CLIENT_TLS_RESUMPTION
+    if (strncmp(session_host, host, len) == 0 && session_host[len] == 0)
+    {
+        http->stats.session_offers++;
+        return;
+    }
+#endif
+    http->stats.full_handshakes++;
+    if (len < MAX_HOST_LEN)
+    {
+        memcpy(session_host, host, len);
+        session_host[len] = 0;
+    }
+    else
+    {
+        session_host[0] = 0;
+    }
+}
+
+/* Same as esp_http_client_perform(), with the body written by body() to the
+ * connection as it is generated: no copy of it is made, whatever its size.
+ * body() runs twice, first only to get the Content-Length */
+static esp_err_t http_perform_json(esp_http_client_handle_t http_client, json_body_cb_t body, const void *arg)
+{
+    char buf[JSON_CHUNK_SIZE];
+    json_gen_str_t jstr;
+    json_gen_str_start(&jstr, NULL, 0, NULL, NULL);
+    body(&jstr, arg);
+    esp_err_t err = esp_http_client_open(http_client, jstr.len);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    json_gen_str_start(&jstr, buf, sizeof(buf), http_write_cb, http_client);
+    if (body(&jstr, arg) != OS_SUCCESS || esp_http_client_fetch_headers(http_client) < 0)
+    {
+        return ESP_FAIL;
+    }
+    // the response goes to the event handler, as with esp_http_client_perform()
+    err = esp_http_client_flush_response(http_client, NULL);
+    // only esp_http_client_perform() readies a kept connection for the next
+    // request, this one can't be reused
+    esp_http_client_close(http_client);
+    return err;
+}
+
+static int http_write_cb(const char *buf, int len, void *priv)
+{
+    return (esp_http_client_write(priv, buf, len) == len) ? OS_SUCCESS : -OS_FAIL;
+}
+
+static int play_body(json_gen_str_t *jstr, const void *arg)
+{
+    const PlayOptions_t *options = arg;
+    json_gen_start_object(jstr);
+    if (options->context_uri)
+    {
+        json_gen_obj_set_string(jstr, "context_uri", options->context_uri);
+    }
+    if (options->num_uris > 0)
+    {
+        json_gen_push_array(jstr, "uris");
+        for (int i = 0; i < options->num_uris; i++)
+        {
+            json_gen_arr_set_string(jstr, options->uris[i]);
+        }
+        json_gen_pop_array(jstr);
+    }
+    if (options->offset > 0)
+    {
+        json_gen_push_object(jstr, "offset");
+        json_gen_obj_set_int(jstr, "position", options->offset);
+        json_gen_pop_object(jstr);
+    }
+    if (options->position_ms > 0)
+    {
+        json_gen_obj_set_int(jstr, "position_ms", options->position_ms);
+    }
+    json_gen_end_object(jstr);
+    return json_gen_str_end(jstr);
+}
+
+static int ids_body(json_gen_str_t *jstr, const void *arg)
+{
+    const IdsBody_t *body = arg;
+    json_gen_start_object(jstr);
+    json_gen_push_array(jstr, body->name);
+    for (int i = 0; i < body->num_ids; i++)
+    {
+        json_gen_arr_set_string(jstr, body->ids[i]);
+    }
+    json_gen_pop_array(jstr);
+    if (body->play >= 0)
+    {
+        json_gen_obj_set_bool(jstr, "play", body->play);
+    }
+    json_gen_end_object(jstr);
+    return json_gen_str_end(jstr);
+}
+
+/* Spotify takes up to LIBRARY_MAX_IDS ids per request */
+static esp_err_t edit_library(esp_spotify_client_handle_t client, esp_http_client_method_t method, const char *const *ids, int num_ids, HttpStatus_Code *status_code)
+{
+    esp_err_t err = ESP_OK;
+    HttpStatus_Code s_code = HttpStatus_Ok;
+    for (int i = 0; i < num_ids && err == ESP_OK && s_code == HttpStatus_Ok; i += LIBRARY_MAX_IDS)
+    {
+        IdsBody_t body = { .name = "ids", .ids = ids + i, .num_ids = num_ids - i, .play = -1 };
+        if (body.num_ids > LIBRARY_MAX_IDS)
+        {
+            body.num_ids = LIBRARY_MAX_IDS;
+        }
+        err = send_json(client, method, PLAYERURL(LIBRARY_TRACKS), ids_body, &body, &s_code);
+    }
+    if (status_code)
+    {
+        *status_code = s_code;
+    }
+    return err;
+}
+
+static esp_err_t http_client_init(esp_spotify_client_handle_t client, HttpClient_t *http, const char *url, size_t buffer_size, http_event_handle_cb http_event_cb)
+{
+    esp_http_client_config_t http_cfg = {
+        .url = url,
+        .user_data = http,
+        .event_handler = http_event_cb_wrapper,
+        .cert_pem = certs_pem_start,
+        .buffer_size_tx = DEFAULT_HTTP_BUF_SIZE + 256,
+        .timeout_ms = HTTP_TIMEOUT_MS,
+        .keep_alive_enable = true,
+#ifdef CONFIG_SPOTIFY_CLIENT_TLS_RESUMPTION
+        .save_client_session = true,
+#endif
+    };
+
+    http->client = client;
+    http->http_event_cb = http_event_cb;
+    if (!(http->lock = xSemaphoreCreateMutex()))
+    {
+        ESP_LOGE(TAG, "Failed to create mutex for %s", url);
+        return ESP_FAIL;
+    }
+    if (buffer_size)
+    {
+        http->user_data.buffer = (uint8_t *)calloc(1, buffer_size);
+        if (!http->user_data.buffer)
+        {
+            ESP_LOGE(TAG, "Error allocating memory for %s", url);
+            return ESP_ERR_NO_MEM;
+        }
+        http->user_data.buffer_size = buffer_size;
+    }
+    http->handle = esp_http_client_init(&http_cfg);
+    if (!http->handle)
+    {
+        ESP_LOGE(TAG, "Error on esp_http_client_init() for %s", url);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static void http_client_deinit(HttpClient_t *http)
+{
+    if (http->handle)
+    {
+        esp_http_client_cleanup(http->handle);
+        http->handle = NULL;
+    }
+    if (http->user_data.buffer)
+    {
+        free(http->user_data.buffer);
+        http->user_data.buffer = NULL;
+    }
+    if (http->lock)
+    {
+        vSemaphoreDelete(http->lock);
+        http->lock = NULL;
+    }
+}
+
+/* Written to the value not in use, which then takes its place: the requests
+ * on any connection read either token whole, none waits for the swap. Called
+ * with the lock of HOST_TOKEN held, there's one writer */
+static void set_access_token(esp_spotify_client_handle_t client, const char *token)
+{
+    uint8_t next = !client->access_token.current;
+    strcpy(client->access_token.value[next] + 7, token);
+    client->access_token.current = next;
+}
+
+static inline const char *access_token(esp_spotify_client_handle_t client)
+{
+    return client->access_token.value[client->access_token.current];
+}
+
 static inline bool access_token_empty(esp_spotify_client_handle_t client)
 {
-    return strlen(client->access_token.value) == 7;
+    return strlen(access_token(client)) == 7;
+}
+
+/* The new token is fetched before this one expires, no request is sent with
+ * an expired token and gets a 401 for it */
+static void schedule_refresh(esp_spotify_client_handle_t client, int expires_in)
+{
+    if (expires_in <= 0)
+    {
+        expires_in = TOKEN_LIFETIME_S;
+    }
+    client->access_token.expiresIn = expires_in;
+    int refresh_in = (expires_in > 2 * TOKEN_REFRESH_MARGIN_S) ? expires_in - TOKEN_REFRESH_MARGIN_S : expires_in / 2;
+    ESP_LOGD(TAG, "Access token expires in %d s, refreshed in %d s", expires_in, refresh_in);
+    xTimerChangePeriod(client->access_token.refresh_timer, pdMS_TO_TICKS(refresh_in * 1000), portMAX_DELAY);
+}
+
+/* Runs on the timer task, which mustn't block: the token is fetched on a
+ * worker */
+static void refresh_timer_cb(TimerHandle_t timer)
+{
+    esp_spotify_client_handle_t client = pvTimerGetTimerID(timer);
+    if (client->access_token.refresh_queued)
+    {
+        return;
+    }
+    client->access_token.refresh_queued = true;
+    if (queue_request(client, REQ_TOKEN, &client->access_token.refresh, 0) != ESP_OK)
+    {
+        client->access_token.refresh_queued = false;
+        xTimerChangePeriod(timer, pdMS_TO_TICKS(TOKEN_RETRY_MS), 0);
+    }
+}
+
+static esp_err_t refresh_request(esp_spotify_client_handle_t client, void *arg)
+{
+    // a token fetched rearms the timer
+    esp_err_t err = get_access_token(client);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Access token refresh failed: %s, retrying in %d s", esp_err_to_name(err), TOKEN_RETRY_MS / 1000);
+        xTimerChangePeriod(client->access_token.refresh_timer, pdMS_TO_TICKS(TOKEN_RETRY_MS), portMAX_DELAY);
+    }
+    return err;
+}
+
+static void refresh_complete(void *arg)
+{
+    esp_spotify_client_handle_t client = arg;
+    client->access_token.refresh_queued = false;
 }
 
-static inline void prepare_client(esp_http_client_handle_t http_client, const char *auth, const char *content_type, const char *url, esp_http_client_method_t method)
+static inline void prepare_client(HttpClient_t *http, const char *auth, const char *content_type, const char *url, esp_http_client_method_t method)
 {
+    esp_http_client_handle_t http_client = http->handle;
+    const char *host = strstr(url, "://");
+    http->host = host ? host + 3 : url;
+    http->host_len = strcspn(http->host, ":/?");
     esp_http_client_set_url(http_client, url);
     esp_http_client_set_method(http_client, method);
     esp_http_client_set_header(http_client, "Authorization", auth);
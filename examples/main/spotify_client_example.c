@@ -112,6 +112,10 @@ void app_main(void)
                 track.progress_ms = track_updated->progress_ms;
                 ESP_LOGW(TAG, "progress: %lld", track.progress_ms);
             }
+        } else if (event.type == PARSE_ERROR) {
+            ESP_LOGW(TAG, "Unreadable event: %s (%s)", esp_err_to_name(event.err), event.field ? event.field : "");
+        } else if (event.type == PLAYER_ERROR) {
+            ESP_LOGW(TAG, "Player not started: %s", esp_err_to_name(event.err));
         }
         player_dispatch_event(client, DATA_PROCESSED_EVENT);
     }